@@ -11,6 +11,9 @@
  * finalised correctly.
  * The application version is split into two bytes for a
  * 16 bit version identifier.
+ * The application CRC is recomputed at boot only when the
+ * application version or length differ from those it was
+ * computed for.
  */
 #define EEPROM_LENGTH			64 // Zero based since it's used for read/write
 #define EEPROM_MAGIC_START		(EEPROM_LENGTH - 2)
@@ -20,9 +23,11 @@
 #define EEPROM_APP_JMP_ADDR		(EEPROM_LENGTH - 10)
 #define EEPROM_BOOT_RED			(EEPROM_LENGTH - 11)
 #define EEPROM_BOOT_GREEN		(EEPROM_LENGTH - 12)
+#define EEPROM_CRC_VER_START	(EEPROM_LENGTH - 14) // app version of the CRC
+#define EEPROM_CRC_LEN_START	(EEPROM_LENGTH - 16) // app length of the CRC
 #define EEPROM_MAGIC_KEY		0xAA55
 
-#define BOOTLOADER_VERSION		0x02
+#define BOOTLOADER_VERSION		0x07
 
 /* TWI Command formats
  *
@@ -37,6 +42,9 @@
  *
  * App CRC (BOOT_CMD_APP_CRC)
  *  SLA+W, 0x43, CRC, STO, SLA+R, ADDR, CMD, CRC[MSB], CRC[LSB], CRC, STO
+ *  From bootloader version 6 the app CRC is a CRC-16 (CCITT, 0x1021,
+ *  initial value 0xFFFF, msb first) of the application from byte 2
+ *  to APP_LEN, before that an XOR of 16 bit words
  *
  * Set Colour (BOOT_CMD_SET_COLOUR)
  *  SLA+W, 0x44, <RED>, <GREEN>, CRC, STO, SLA+R, ADDR, CMD, CRC, STO
@@ -47,12 +55,51 @@
  * Write flash [Part B] (BOOT_CMD_WRITE_FLASH_B)
  *	SLA+W, 0x51, {0..31}, CRC, STO, SLA+R, ADDR, CMD, CRC, STO
  *
+ * Write flash page (BOOT_CMD_WRITE_FLASH_PAGE)
+ *	SLA+W, 0x53, PAGE, {0..63}, SUM[MSB], SUM[LSB], CRC, STO, SLA+R, ADDR, CMD, PAGE, PENDING, STATUS, CRC, STO
+ *  A whole page in one transaction. SUM is the XOR of the page as
+ *  16 bit words, msb first. A page with
+ *  a bad SUM is refused, PENDING and STATUS are as for the flash status.
+ *
+ * Page hash (BOOT_CMD_PAGE_HASH)
+ *	SLA+W, 0x54, PAGE, COUNT, CRC, STO, SLA+R, ADDR, CMD, PAGE, N, {HASH[MSB], HASH[LSB]} * N, CRC, STO
+ *  The CRC-16 of N pages from PAGE, as the app CRC, where N is COUNT
+ *  limited to BOOT_HASH_PAGES and the application section. Page 0 is
+ *  hashed with the app's reset vector, as the master sent it. A delta
+ *  update hashes the pages, starting with page 0, which clears WRITTEN
+ *  and STATUS, and writes only those that differ before finalising.
+ *
+ * Flash status (BOOT_CMD_FLASH_STATUS)
+ *	SLA+W, 0x52, CRC, STO, SLA+R, ADDR, CMD, PENDING, WRITTEN, STATUS, CRC, STO
+ *
  * Finalise flash (BOOT_CMD_FINALISE_FLASH)
  *	SLA+W, 0x55, VER[MSB], VER[LSB], APP_LEN[MSB], APP_LEN[LSB], APP_CRC[MSB], APP_CRC[LSB], CRC, STO, SLA+R, ADDR, CMD, CRC, STO
  *
  * Boot App (BOOT_CMD_BOOT_APP)
  *	SLA+W, 0x60, NONCE, CRC, STO, SLA+R, ADDR, CMD, CRC, STO
  *
+ * Streaming (bootloader version 3 and later)
+ *  Pages are double buffered: a page is queued for programming once
+ *  its part B (or the whole page) is received, and the next page is
+ *  received into the other buffer. A queued page is programmed once
+ *  its reply has been read, or, if the master skips the replies,
+ *  when a third page starts to arrive. The CPU halts while a page is
+ *  erased and written and the TWI clock is stretched meanwhile, so
+ *  the master can send
+ *  the pages back to back and read the flash status once before
+ *  finalising: PENDING pages not yet programmed, WRITTEN pages
+ *  programmed since page 0 was received, STATUS the BOOT_STATUS_ flags.
+ *
+ * Broadcast (bootloader version 5 and later)
+ *	0x00, 0x00, LEN, CMD, {..}, CRC, STO
+ *  The flash writes (A, B, whole page and finalise) can be sent to
+ *  every node at once by general call. The command of LEN bytes
+ *  follows a station mask of 0x00, so nodes running the application
+ *  ignore it as a broadcast record for no station, and CRC is the
+ *  XOR of every byte after the general call address. A broadcast has
+ *  no reply, so each page is programmed as soon as it is received and
+ *  the clock is stretched until the slowest node is done. The master
+ *  then reads the flash status and app CRC of each node in turn.
  */
 
 // Commands
@@ -66,6 +113,9 @@
 
 #define BOOT_CMD_WRITE_FLASH_A	0x50
 #define BOOT_CMD_WRITE_FLASH_B	0x51
+#define BOOT_CMD_FLASH_STATUS	0x52
+#define BOOT_CMD_WRITE_FLASH_PAGE	0x53
+#define BOOT_CMD_PAGE_HASH		0x54
 #define BOOT_CMD_FINALISE_FLASH	0x55
 
 #define BOOT_CMD_BOOT_APP		0x60
@@ -74,8 +124,19 @@
 #define BOOT_CMD_PING_NONCE		0x2A
 #define BOOT_CMD_BOOT_NONCE		0xA2
 
+// Flash page buffers
+#define BOOT_PAGE_BUFFERS		2
+
+// Pages per page hash reply
+#define BOOT_HASH_PAGES			8
+
+// Flash status flags
+#define BOOT_STATUS_BAD_PAGE	0x01 // a page outside the application was refused
+#define BOOT_STATUS_BAD_SUM		0x02 // a page with a bad checksum was refused
+#define BOOT_STATUS_VERIFY		0x04 // a page read back differently after programming
+
 uint8_t BOOT_isCommandFresh;
-uint8_t BOOT_waitingToFlash;
+uint8_t BOOT_waitingToFlash; // pages queued for programming
 uint8_t BOOT_waitingToFinalise;
 uint8_t BOOT_shouldBootApp;
 uint16_t app_jump_addr;
@@ -85,5 +146,6 @@ void BOOT_processBuffer(void);
 void BOOT_write_flash_page(void);
 void BOOT_finalise_flash(void);
 void BOOT_updateAppChecksum(void);
+void BOOT_checkAppChecksum(void);
 
 #endif /* BOOT_MANAGER_H */
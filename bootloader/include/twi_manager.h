@@ -2,8 +2,9 @@
 #define  TWI_MANAGER_H
 
 #define TWI_BASE_ADDRESS	0xD0
-#define TWI_SLW_BUFFER_SIZE 40
-#define TWI_SLR_BUFFER_SIZE 10
+#define TWI_SLW_BUFFER_SIZE 72 // holds BOOT_CMD_WRITE_FLASH_PAGE
+#define TWI_SLR_BUFFER_SIZE 21 // holds BOOT_CMD_PAGE_HASH
+#define TWI_BROADCAST_HEADER 2 // station mask and length, see boot_manager.h
 
 #define ZERO				0x00
 
@@ -37,8 +38,11 @@
 // TWI Slave Receiver staus codes
 #define TWI_SRX_ADR_ACK            0x60  // Own SLA+W has been received ACK has been returned
 #define TWI_SRX_ADR_ACK_M_ARB_LOST 0x68  // Arbitration lost in SLA+R/W as Master; own SLA+W has been received; ACK has been returned
+#define TWI_SRX_GEN_ACK            0x70  // General call address has been received; ACK has been returned
 #define TWI_SRX_ADR_DATA_ACK       0x80  // Previously addressed with own SLA+W; data has been received; ACK has been returned
 #define TWI_SRX_ADR_DATA_NACK      0x88  // Previously addressed with own SLA+W; data has been received; NOT ACK has been returned
+#define TWI_SRX_GEN_DATA_ACK       0x90  // Previously addressed with general call; data has been received; ACK has been returned
+#define TWI_SRX_GEN_DATA_NACK      0x98  // Previously addressed with general call; data has been received; NOT ACK has been returned
 #define TWI_SRX_STOP_RESTART       0xA0  // A STOP condition or repeated START condition has been received while still addressed as Slave
 
 // TWI Miscellaneous status codes
@@ -52,6 +56,7 @@ uint8_t TWI_Ptr;
 uint8_t TWI_Buffer[TWI_SLW_BUFFER_SIZE];
 uint8_t TWI_BufferXOR;
 uint8_t TWI_masterXOR;
+uint8_t TWI_isBroadcast; // buffer was received by general call
 
 char* TWI_getBuffer(void);
 uint8_t TWI_getBufferSize(void);
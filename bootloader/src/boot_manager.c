@@ -8,9 +8,19 @@
 #include "node_manager.h"
 #include "twi_manager.h"
 
-// Flash buffer
-static uint8_t flash_buf[SPM_PAGESIZE];
-static uint16_t flash_addr;
+#define BOOT_CRC_INIT		0xFFFF
+#define BOOT_CRC_NO_PAGE	0xFFFF
+
+// Flash page buffers, the next page is received into one
+//  while the other waits to be programmed
+static uint8_t flash_buf[BOOT_PAGE_BUFFERS][SPM_PAGESIZE];
+static uint16_t flash_addr[BOOT_PAGE_BUFFERS];
+static uint8_t flash_next;			// oldest buffer waiting to be programmed
+static uint8_t flash_part_a;		// part A received into the free buffer
+static uint8_t flash_written;		// pages programmed since page 0
+static uint8_t flash_status;		// BOOT_STATUS_ flags
+static uint16_t flash_crc;			// app CRC up to flash_crc_page
+static uint16_t flash_crc_page = BOOT_CRC_NO_PAGE; // last page written in order from page 0
 static uint8_t reply[TWI_SLR_BUFFER_SIZE];
 
 static uint16_t app_version;
@@ -21,6 +31,81 @@ extern uint8_t TWI_masterXOR;
 extern uint8_t TWI_BufferXOR;
 
 static void BOOT_eepromWriteWord(uint16_t addr, uint16_t value);
+static void BOOT_storeAppChecksum(uint16_t crc);
+
+// CRC-16 CCITT, one nibble at a time
+static const uint16_t BOOT_crcTable[16] PROGMEM = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+static uint16_t BOOT_crcByte(uint16_t crc, uint8_t data)
+{
+	crc = (crc << 4) ^ pgm_read_word(&BOOT_crcTable[(crc >> 12) ^ (data >> 4)]);
+	crc = (crc << 4) ^ pgm_read_word(&BOOT_crcTable[(crc >> 12) ^ (data & 0x0F)]);
+	return crc;
+}
+
+// CRC of the application flash from addr to end, skipping
+//  the reset vector, which belongs to the bootloader
+static uint16_t BOOT_crcFlash(uint16_t crc, uint16_t addr, uint16_t end)
+{
+	if(addr < 2)
+		addr = 2;
+	
+	for(; addr < end; addr++)
+		crc = BOOT_crcByte(crc, pgm_read_byte(addr));
+	return crc;
+}
+
+// CRC of a page as the master sent it, the reset vector of
+//  page 0 is rebuilt from the stored jump address
+static uint16_t BOOT_pageHash(uint16_t pagestart)
+{
+	uint16_t crc = BOOT_CRC_INIT;
+	
+	if(pagestart == INTVECT_PAGE_ADDRESS) {
+		uint16_t rjmp = eeprom_read_word((uint16_t*)EEPROM_APP_JMP_ADDR) + (0xC000 - 1);
+		crc = BOOT_crcByte(crc, rjmp & 0xFF);
+		crc = BOOT_crcByte(crc, rjmp >> 8);
+	}
+	return BOOT_crcFlash(crc, pagestart, pagestart + SPM_PAGESIZE);
+}
+
+// buffer receiving the next page
+static uint8_t BOOT_rxBuffer(void)
+{
+	return (flash_next + BOOT_waitingToFlash) % BOOT_PAGE_BUFFERS;
+}
+
+// start receiving a page, returns its buffer
+static uint8_t *BOOT_rxPage(uint8_t page)
+{
+	// Both buffers hold pages, the master is streaming without
+	//  reading the replies. Program the oldest now, the master's
+	//  next transaction is clock stretched until it is written
+	if(BOOT_waitingToFlash == BOOT_PAGE_BUFFERS)
+		BOOT_write_flash_page();
+	
+	// Page 0 starts a new application image
+	if(page == 0) {
+		flash_written = 0;
+		flash_status = 0;
+	}
+	
+	flash_addr[BOOT_rxBuffer()] = page*SPM_PAGESIZE;
+	return flash_buf[BOOT_rxBuffer()];
+}
+
+// XOR of 16 bit words, msb first, as for the app checksum
+static uint16_t BOOT_pageChecksum(const uint8_t *buf)
+{
+	uint16_t sum = 0x0000;
+	uint8_t i;
+	for(i = 0; i < SPM_PAGESIZE; i+=2)
+		sum ^= (buf[i] << 8) | buf[i+1];
+	return sum;
+}
 
 void BOOT_processBuffer(void)
 {	
@@ -36,6 +121,20 @@ void BOOT_processBuffer(void)
 			return;
 		}
 		
+		// Only the flash writes can be broadcast
+		if(TWI_isBroadcast) {
+			switch(TWI_Buffer[0]) {
+				case BOOT_CMD_WRITE_FLASH_A:
+				case BOOT_CMD_WRITE_FLASH_B:
+				case BOOT_CMD_WRITE_FLASH_PAGE:
+				case BOOT_CMD_FINALISE_FLASH:
+					break;
+				default:
+					BOOT_isCommandFresh = 0;
+					return;
+			}
+		}
+		
 		uint16_t temp;
 		switch(TWI_Buffer[0])
 		{
@@ -97,12 +196,9 @@ void BOOT_processBuffer(void)
 				reply[2] = TWI_BufferXOR;
 				TWI_SetReply(reply, 3);
 				
-				// Clear the 64 byte flash buffer and copy TWI buffer to flash buffer
-				//memset(flash_buf, 0, SPM_PAGESIZE);
-				memcpy(flash_buf, TWI_Buffer+2, SPM_PAGESIZE/2);
-				
-				// Extract the page byte
-				flash_addr = TWI_Buffer[1]*SPM_PAGESIZE;
+				// Copy TWI buffer to the free flash buffer
+				memcpy(BOOT_rxPage(TWI_Buffer[1]), TWI_Buffer+2, SPM_PAGESIZE/2);
+				flash_part_a = 1;
 				break;
 
 			case BOOT_CMD_WRITE_FLASH_B:
@@ -111,11 +207,74 @@ void BOOT_processBuffer(void)
 				reply[2] = TWI_BufferXOR;
 				TWI_SetReply(reply, 3);
 			
-				// Clear the 64 byte flash buffer and copy TWI buffer to flash buffer
-				memcpy(flash_buf+(SPM_PAGESIZE/2), TWI_Buffer+1, SPM_PAGESIZE/2);
+				if(flash_part_a) {
+					// Copy TWI buffer to the free flash buffer and queue the page
+					memcpy(flash_buf[BOOT_rxBuffer()]+(SPM_PAGESIZE/2), TWI_Buffer+1, SPM_PAGESIZE/2);
+					BOOT_waitingToFlash++;
+					flash_part_a = 0;
+				} else if(BOOT_waitingToFlash) {
+					// A resend of part B, the page is still queued
+					uint8_t last = (flash_next + BOOT_waitingToFlash - 1) % BOOT_PAGE_BUFFERS;
+					memcpy(flash_buf[last]+(SPM_PAGESIZE/2), TWI_Buffer+1, SPM_PAGESIZE/2);
+				}
+				// Otherwise a resend of part B after the page
+				//  was written, there is nothing left to do
+				break;
+
+			case BOOT_CMD_WRITE_FLASH_PAGE:
+				// Queue the page if it is complete and its checksum matches
+				temp = (TWI_Buffer[2+SPM_PAGESIZE] << 8) | TWI_Buffer[3+SPM_PAGESIZE];
+				if(TWI_Ptr == 4+SPM_PAGESIZE &&
+					BOOT_pageChecksum(TWI_Buffer+2) == temp) {
+					memcpy(BOOT_rxPage(TWI_Buffer[1]), TWI_Buffer+2, SPM_PAGESIZE);
+					BOOT_waitingToFlash++;
+					flash_part_a = 0;
+				} else {
+					flash_status |= BOOT_STATUS_BAD_SUM;
+				}
 				
-				// Schedule a write flash operation
-				BOOT_waitingToFlash = 1;
+				reply[0] = (TWAR>>1);
+				reply[1] = BOOT_CMD_WRITE_FLASH_PAGE;
+				reply[2] = TWI_Buffer[1];
+				reply[3] = BOOT_waitingToFlash;
+				reply[4] = flash_status;
+				reply[5] = TWI_BufferXOR;
+				TWI_SetReply(reply, 6);
+				break;
+
+			case BOOT_CMD_PAGE_HASH:
+				// Hashing from page 0 starts a delta update
+				if(TWI_Buffer[1] == 0) {
+					flash_written = 0;
+					flash_status = 0;
+				}
+				
+				reply[0] = (TWAR>>1);
+				reply[1] = BOOT_CMD_PAGE_HASH;
+				reply[2] = TWI_Buffer[1];
+				reply[3] = 0;
+				
+				// As many pages as asked for and fit, up to the bootloader
+				while(reply[3] < TWI_Buffer[2] && reply[3] < BOOT_HASH_PAGES &&
+					TWI_Buffer[1] + reply[3] < BOOTLOADER_START/SPM_PAGESIZE) {
+					temp = BOOT_pageHash((TWI_Buffer[1] + reply[3])*SPM_PAGESIZE);
+					reply[4 + 2*reply[3]] = temp >> 8;
+					reply[5 + 2*reply[3]] = temp & 0xFF;
+					reply[3]++;
+				}
+				
+				reply[4 + 2*reply[3]] = TWI_BufferXOR;
+				TWI_SetReply(reply, 5 + 2*reply[3]);
+				break;
+
+			case BOOT_CMD_FLASH_STATUS:
+				reply[0] = (TWAR>>1);
+				reply[1] = BOOT_CMD_FLASH_STATUS;
+				reply[2] = BOOT_waitingToFlash;
+				reply[3] = flash_written;
+				reply[4] = flash_status;
+				reply[5] = TWI_BufferXOR;
+				TWI_SetReply(reply, 6);
 				break;
 
 			case BOOT_CMD_FINALISE_FLASH:
@@ -165,30 +324,38 @@ void BOOT_processBuffer(void)
 
 void BOOT_write_flash_page(void)
 {
-	// Clear the waiting to flash flag
-	BOOT_waitingToFlash = 0;
+	// Take the oldest queued page
+	uint8_t *buf = flash_buf[flash_next];
+	uint16_t pagestart = flash_addr[flash_next];
+	uint8_t *p = buf;
 	
-	uint16_t pagestart = flash_addr;
-	uint8_t *p = flash_buf;
+	flash_next = (flash_next + 1) % BOOT_PAGE_BUFFERS;
+	BOOT_waitingToFlash--;
 
 	// Don't touch the bootloader section
 	if(pagestart >= BOOTLOADER_START) {
+		flash_status |= BOOT_STATUS_BAD_PAGE;
 		return;
 	}
 	
 	// Preserve the interrupt vector table on the first page
 	if(pagestart == INTVECT_PAGE_ADDRESS) {
 		// Save the real jump address for later
-		app_jump_addr = ((flash_buf[1] << 8) | flash_buf[0]) - (0xC000 - 1); // Little endian...
-		flash_buf[0] = pgm_read_byte(INTVECT_PAGE_ADDRESS + 0);
-		flash_buf[1] = pgm_read_byte(INTVECT_PAGE_ADDRESS + 1);
+		app_jump_addr = ((buf[1] << 8) | buf[0]) - (0xC000 - 1); // Little endian...
+		buf[0] = pgm_read_byte(INTVECT_PAGE_ADDRESS + 0);
+		buf[1] = pgm_read_byte(INTVECT_PAGE_ADDRESS + 1);
 		
-		// Also erase the magic EEPROM key and app version
+		// The stored jump address no longer matches the page
+		BOOT_eepromWriteWord(EEPROM_APP_JMP_ADDR, 0xFFFF);
+	}
+	
+	// The first page written erases the magic EEPROM key and app
+	//  version, a delta update need not start with page 0
+	if(eeprom_read_word((uint16_t*)EEPROM_MAGIC_START) != 0xFFFF) {
 		BOOT_eepromWriteWord(EEPROM_MAGIC_START, 0xFFFF);
 		BOOT_eepromWriteWord(EEPROM_APP_VER_START, 0xFFFF);
 		BOOT_eepromWriteWord(EEPROM_APP_CRC_START, 0xFFFF);
 		BOOT_eepromWriteWord(EEPROM_APP_LEN_START, 0xFFFF);
-		BOOT_eepromWriteWord(EEPROM_APP_JMP_ADDR, 0xFFFF);
 	}
 	
 	// Erase the page and wait
@@ -200,12 +367,33 @@ void BOOT_write_flash_page(void)
 	for(i = 0; i < SPM_PAGESIZE; i+=2) {
 		uint16_t data = *p++;
 		data += (*p++) << 8;
-		boot_page_fill(flash_addr+i, data);
+		boot_page_fill(pagestart+i, data);
 	}
 
 	// Commit the new page to flash
 	boot_page_write(pagestart);
 	boot_spm_busy_wait();
+	
+	// Read the page back
+	uint16_t sum = BOOT_pageChecksum(buf);
+	for(i = 0; i < SPM_PAGESIZE; i+=2)
+		sum ^= (pgm_read_byte(pagestart+i) << 8) | pgm_read_byte(pagestart+i+1);
+	if(sum != 0)
+		flash_status |= BOOT_STATUS_VERIFY;
+	
+	// Keep the app CRC up to the start of this page while the
+	//  pages are written in order, finalising adds the last one
+	if(pagestart == 0) {
+		flash_crc = BOOT_CRC_INIT;
+		flash_crc_page = 0;
+	} else if(pagestart == flash_crc_page + SPM_PAGESIZE) {
+		flash_crc = BOOT_crcFlash(flash_crc, flash_crc_page, pagestart);
+		flash_crc_page = pagestart;
+	} else {
+		flash_crc_page = BOOT_CRC_NO_PAGE;
+	}
+	
+	flash_written++;
 }
 
 void BOOT_finalise_flash(void)
@@ -216,8 +404,14 @@ void BOOT_finalise_flash(void)
 	BOOT_eepromWriteWord(EEPROM_APP_LEN_START, app_length);
 	BOOT_eepromWriteWord(EEPROM_APP_JMP_ADDR, app_jump_addr);
 	
-	// Update the checksum of the application flash
-	BOOT_updateAppChecksum();
+	// Finish the checksum of the pages written in order, or
+	//  read the whole application if they were not
+	if(flash_crc_page != BOOT_CRC_NO_PAGE &&
+		app_length > flash_crc_page &&
+		app_length <= flash_crc_page + SPM_PAGESIZE)
+		BOOT_storeAppChecksum(BOOT_crcFlash(flash_crc, flash_crc_page, app_length));
+	else
+		BOOT_updateAppChecksum();
 	
 	// Clear the waiting to finalise flag
 	BOOT_waitingToFinalise = 0;
@@ -226,18 +420,29 @@ void BOOT_finalise_flash(void)
 void BOOT_updateAppChecksum(void)
 {
 	/* Calculate application checksum */
-	uint16_t i, app_len;
-	uint16_t calced_checksum = 0x0000;
+	uint16_t app_len;
 	
 	app_len = eeprom_read_word((uint16_t*)EEPROM_APP_LEN_START);
 	
-	if(app_len >= BOOTLOADER_START)
+	if(app_len > BOOTLOADER_START)
 		return;
 	
-	for(i = 2; i < app_len; i+=2) {
-		calced_checksum ^= (pgm_read_byte(i) << 8) | pgm_read_byte(i+1);
-	}
-	BOOT_eepromWriteWord(EEPROM_APP_CRC_START, calced_checksum);
+	BOOT_storeAppChecksum(BOOT_crcFlash(BOOT_CRC_INIT, 2, app_len));
+}
+
+void BOOT_checkAppChecksum(void)
+{
+	// Only read the application if it changed since its checksum was stored
+	if(eeprom_read_word((uint16_t*)EEPROM_APP_VER_START) != eeprom_read_word((uint16_t*)EEPROM_CRC_VER_START) ||
+		eeprom_read_word((uint16_t*)EEPROM_APP_LEN_START) != eeprom_read_word((uint16_t*)EEPROM_CRC_LEN_START))
+		BOOT_updateAppChecksum();
+}
+
+static void BOOT_storeAppChecksum(uint16_t crc)
+{
+	BOOT_eepromWriteWord(EEPROM_APP_CRC_START, crc);
+	BOOT_eepromWriteWord(EEPROM_CRC_VER_START, eeprom_read_word((uint16_t*)EEPROM_APP_VER_START));
+	BOOT_eepromWriteWord(EEPROM_CRC_LEN_START, eeprom_read_word((uint16_t*)EEPROM_APP_LEN_START));
 }
 
 static void BOOT_eepromWriteWord(uint16_t addr, uint16_t data)
@@ -45,6 +45,9 @@ int main(void)
 	
 	jump_to_app = (void*)eeprom_read_word((uint16_t*)EEPROM_APP_JMP_ADDR);
 	
+	// Kept by a delta update that leaves page 0 unchanged
+	app_jump_addr = eeprom_read_word((uint16_t*)EEPROM_APP_JMP_ADDR);
+	
 	// Get RJMP address (Reset) from the Boot Loader section and provided with OFFEST 0x1A00:
 	rjmp = pgm_read_word(BOOTLOADER_START) + BOOTLOADER_START / 2;
 	
@@ -69,8 +72,9 @@ int main(void)
 		boot_spm_busy_wait ();
 	}
 	
-	// Store the current application checksum in the EEPROM for querying later
-	BOOT_updateAppChecksum();
+	// Store the current application checksum in the EEPROM for querying later,
+	//  if the application changed since it was last stored
+	BOOT_checkAppChecksum();
 
 	#define TCCR1A_PWM_MODE		0b10100000
 	#define TCCR1A_FAST_PWM8	0b00000001
@@ -133,8 +137,8 @@ int main(void)
 		BOOT_processBuffer();
 		
 		if(!TWI_readIsBusy) {
-			// Process a waiting flash write after TWI transactions
-			if(BOOT_waitingToFlash)
+			// Process waiting flash writes after TWI transactions
+			while(BOOT_waitingToFlash)
 				BOOT_write_flash_page();
 			
 			// Process a waiting finalise after TWI transactions
@@ -15,7 +15,7 @@ static uint8_t TWI_ReplyBuf[TWI_SLR_BUFFER_SIZE];
 // TWI application status flags
 static uint8_t TWI_isBufferAvailable; 
 
-static void TWI_Process_Slave_Receive(void);
+static void TWI_Process_Slave_Receive(uint8_t isGeneralCall);
 static void TWI_Process_Slave_Transmit(void);
 
 extern uint8_t NODE_station;
@@ -28,7 +28,7 @@ void TWI_init(void) {
     uint8_t TWI_SLAVE_ADDRESS = (TWI_BASE_ADDRESS + (NODE_station << 1));
 
     // TWI Config
-    TWAR = TWI_SLAVE_ADDRESS;
+    TWAR = TWI_SLAVE_ADDRESS | TWAR_TWGCE;
     TWCR = TWCR_TWEN;// | TWCR_TWEA | TWCR_TWIE;
 	
 	TWI_readIsBusy = 0;
@@ -37,11 +37,12 @@ void TWI_init(void) {
 // reset bit pattern for TWI control register
 const char TWCR_RESET = TWCR_TWINT | TWCR_TWEA | TWCR_TWEN;// | TWCR_TWIE;
 
-static void TWI_Process_Slave_Receive(void) {
+static void TWI_Process_Slave_Receive(uint8_t isGeneralCall) {
 	// reset pointer
 	TWI_Ptr = 0;
 	TWI_isBufferAvailable = 1;
-	TWI_BufferXOR = (TWAR>>1);
+	TWI_isBroadcast = isGeneralCall;
+	TWI_BufferXOR = isGeneralCall ? 0x00 : (TWAR>>1);
 	
 	uint8_t rx_finished = 0;
 	do {
@@ -54,6 +55,7 @@ static void TWI_Process_Slave_Receive(void) {
 		// Check TWI status code for SLAVERX_ACK
 		switch (TWSR) {
 			case TWI_SRX_ADR_DATA_ACK:
+			case TWI_SRX_GEN_DATA_ACK:
 				// Record received data until buffer is full
 				if (TWI_Ptr == TWI_SLW_BUFFER_SIZE)
 					TWI_isBufferAvailable = 0;
@@ -63,10 +65,14 @@ static void TWI_Process_Slave_Receive(void) {
 				}
 				break;
 			case TWI_SRX_ADR_DATA_NACK:
+			case TWI_SRX_GEN_DATA_NACK:
 			case TWI_SRX_STOP_RESTART:
 				TWCR = TWCR_RESET;
-				TWI_masterXOR = TWI_Buffer[--TWI_Ptr];
-				BOOT_isCommandFresh = 1;
+				// An empty write (or the sync pulse) is not a command
+				if (TWI_Ptr > 0) {
+					TWI_masterXOR = TWI_Buffer[--TWI_Ptr];
+					BOOT_isCommandFresh = 1;
+				}
 				rx_finished = 1;
 				break;
 			default:
@@ -79,6 +85,18 @@ static void TWI_Process_Slave_Receive(void) {
 	// XOR against the last byte again to reverse that XOR...
 	TWI_BufferXOR ^= TWI_masterXOR;
 	
+	// A broadcast starts with a record for no station and the
+	//  command length, strip it (see boot_manager.h)
+	if (isGeneralCall && BOOT_isCommandFresh) {
+		if (TWI_Ptr > TWI_BROADCAST_HEADER && TWI_Buffer[0] == 0x00 &&
+			TWI_Buffer[1] == TWI_Ptr - TWI_BROADCAST_HEADER) {
+			TWI_Ptr -= TWI_BROADCAST_HEADER;
+			memmove(TWI_Buffer, TWI_Buffer + TWI_BROADCAST_HEADER, TWI_Ptr);
+		} else {
+			BOOT_isCommandFresh = 0;
+		}
+	}
+	
 	// always release clock line
 	TWCR |= (1<<TWINT);
 }
@@ -133,7 +151,11 @@ void TWI_Process(void) {
 		case TWI_SRX_ADR_ACK:
 		case TWI_SRX_STOP_RESTART:
 		case TWI_SRX_ADR_DATA_ACK:
-			TWI_Process_Slave_Receive();
+			TWI_Process_Slave_Receive(0);
+			break;
+		case TWI_SRX_GEN_ACK:
+		case TWI_SRX_GEN_DATA_ACK:
+			TWI_Process_Slave_Receive(1);
 			break;
 		case TWI_STX_ADR_ACK:
 		case TWI_STX_DATA_ACK:
@@ -153,7 +175,11 @@ void TWI_SetReply(uint8_t *buf, uint8_t len)
     if (len > sizeof(TWI_ReplyBuf)) {
         len = sizeof(TWI_ReplyBuf);
     }
+    // A broadcast cannot be read back, there is no reply to wait for
+    if (TWI_isBroadcast) {
+        len = 0;
+    }
     memcpy(TWI_ReplyBuf, buf, len);
     TWI_ReplyLen = len;
-	TWI_readIsBusy = 1;
+	TWI_readIsBusy = !TWI_isBroadcast;
 }
@@ -0,0 +1,35 @@
+/**********************************************************************
+
+  carrier.h - shared carrier functions for the pattern generator. 
+    Sine and cosine are read from a quarter-wave table kept in flash
+    and linearly interpolated, instead of calling the libm versions.
+
+    Inputs are 16-bit binary angles, where a full revolution of 2*pi
+    radians is 0x10000. Outputs are Q14, where 1.0 == CARRIER_ONE.
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#ifndef  CARRIER_H
+#define  CARRIER_H
+
+#include "utilities.h"
+
+// carrier function unity value, Q14
+#define CARRIER_ONE             16384
+
+// the quarter-wave table has 2^CARRIER_TABLE_BITS segments, 
+//   plus one entry for the end point at pi/2
+#define CARRIER_TABLE_BITS      6
+#define CARRIER_TABLE_SIZE      ((1 << CARRIER_TABLE_BITS) + 1)
+
+int16_t CARRIER_sin(uint16_t);
+int16_t CARRIER_cos(uint16_t);
+
+#endif
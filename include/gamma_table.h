@@ -0,0 +1,45 @@
+// generated by tools/gen_gamma.py, do not edit
+#ifndef  GAMMA_TABLE_H
+#define  GAMMA_TABLE_H
+
+#define WG_GAMMA_TABLE_COUNT  1
+
+static const uint16_t _WG_gammaTables[WG_GAMMA_TABLE_COUNT][256] PROGMEM = {
+    // gamma 2.2
+    {
+        0x0000, 0x0000, 0x0002, 0x0004, 0x0007, 0x000B, 0x0011, 0x0018,
+        0x0020, 0x002A, 0x0035, 0x0041, 0x004E, 0x005E, 0x006E, 0x0080,
+        0x0094, 0x00A9, 0x00BF, 0x00D8, 0x00F1, 0x010D, 0x012A, 0x0148,
+        0x0168, 0x018A, 0x01AE, 0x01D3, 0x01FA, 0x0223, 0x024D, 0x0279,
+        0x02A7, 0x02D6, 0x0308, 0x033B, 0x0370, 0x03A6, 0x03DF, 0x0419,
+        0x0455, 0x0493, 0x04D3, 0x0514, 0x0558, 0x059D, 0x05E4, 0x062D,
+        0x0678, 0x06C5, 0x0714, 0x0765, 0x07B7, 0x080C, 0x0862, 0x08BB,
+        0x0915, 0x0971, 0x09D0, 0x0A30, 0x0A92, 0x0AF6, 0x0B5C, 0x0BC5,
+        0x0C2F, 0x0C9B, 0x0D09, 0x0D7A, 0x0DEC, 0x0E60, 0x0ED6, 0x0F4F,
+        0x0FC9, 0x1046, 0x10C4, 0x1145, 0x11C8, 0x124D, 0x12D3, 0x135C,
+        0x13E8, 0x1475, 0x1504, 0x1595, 0x1629, 0x16BF, 0x1756, 0x17F0,
+        0x188C, 0x192A, 0x19CB, 0x1A6D, 0x1B12, 0x1BB9, 0x1C62, 0x1D0D,
+        0x1DBA, 0x1E6A, 0x1F1B, 0x1FCF, 0x2085, 0x213D, 0x21F8, 0x22B5,
+        0x2373, 0x2434, 0x24F8, 0x25BD, 0x2685, 0x274F, 0x281B, 0x28EA,
+        0x29BA, 0x2A8D, 0x2B63, 0x2C3A, 0x2D14, 0x2DF0, 0x2ECE, 0x2FAF,
+        0x3091, 0x3177, 0x325E, 0x3348, 0x3433, 0x3522, 0x3612, 0x3705,
+        0x37FA, 0x38F2, 0x39EB, 0x3AE8, 0x3BE6, 0x3CE7, 0x3DEA, 0x3EEF,
+        0x3FF7, 0x4101, 0x420D, 0x431C, 0x442D, 0x4541, 0x4656, 0x476F,
+        0x4889, 0x49A6, 0x4AC5, 0x4BE7, 0x4D0B, 0x4E31, 0x4F5A, 0x5085,
+        0x51B3, 0x52E2, 0x5415, 0x5549, 0x5680, 0x57BA, 0x58F6, 0x5A34,
+        0x5B75, 0x5CB8, 0x5DFE, 0x5F46, 0x6090, 0x61DD, 0x632C, 0x647E,
+        0x65D2, 0x6728, 0x6881, 0x69DD, 0x6B3B, 0x6C9B, 0x6DFE, 0x6F63,
+        0x70CB, 0x7235, 0x73A2, 0x7511, 0x7682, 0x77F6, 0x796D, 0x7AE6,
+        0x7C61, 0x7DDF, 0x7F60, 0x80E3, 0x8268, 0x83F0, 0x857A, 0x8707,
+        0x8897, 0x8A29, 0x8BBD, 0x8D54, 0x8EED, 0x9089, 0x9228, 0x93C9,
+        0x956C, 0x9712, 0x98BB, 0x9A66, 0x9C14, 0x9DC4, 0x9F77, 0xA12C,
+        0xA2E4, 0xA49E, 0xA65B, 0xA81A, 0xA9DC, 0xABA1, 0xAD68, 0xAF31,
+        0xB0FE, 0xB2CC, 0xB49E, 0xB672, 0xB848, 0xBA21, 0xBBFD, 0xBDDB,
+        0xBFBC, 0xC19F, 0xC385, 0xC56E, 0xC759, 0xC946, 0xCB37, 0xCD2A,
+        0xCF1F, 0xD117, 0xD312, 0xD50F, 0xD70F, 0xD912, 0xDB17, 0xDD1F,
+        0xDF29, 0xE136, 0xE346, 0xE558, 0xE76D, 0xE984, 0xEB9E, 0xEDBB,
+        0xEFDA, 0xF1FC, 0xF421, 0xF648, 0xF872, 0xFA9F, 0xFCCE, 0xFF00,
+    },
+};
+
+#endif
@@ -0,0 +1,40 @@
+/**********************************************************************
+
+  hal.h - thin hardware abstraction layer. Application modules include
+    this header in place of the avr-libc headers, so the same sources 
+    can be compiled for the target or natively on a host. 
+
+    On the target this simply pulls in avr-libc. When HOST_BUILD is
+    defined, registers, ISR declarations, flash/eeprom access and the
+    watchdog are instead provided by hal_host.h (see tools/host), and
+    ISRs become plain functions a host driver can call directly.
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#ifndef  HAL_H
+#define  HAL_H
+
+#ifdef HOST_BUILD
+
+#include "hal_host.h"
+
+#else
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+
+#endif
+
+#endif
@@ -18,11 +18,12 @@
 #define  LIGHT_PATTERN_PROTOCOL_H
 
 #include "pattern_generator.h"
+#include "synchro_clock.h"
 #include "utilities.h"
 
-// for use in solo oreoleds, this number must match the period defined 
-//   in the synchro clock header
-#define MAX_PATTERN_PERIOD 4000.0
+// for use in solo oreoleds, the pattern period (ms) at a speed 
+//   of one is the period of the synchro clock
+#define MAX_PATTERN_PERIOD SYNCLK_PERIOD_MS
 
 // Nonce used to verify reset command is valid
 #define RESET_NONCE		0x2A
@@ -39,7 +40,7 @@
 #define COLOUR_AMBER_B	0
 
 #define EEPROM_LENGTH			64 // Zero based since it's used for read/write
-#define EEPROM_APP_CRC_START	(EEPROM_LENGTH - 6)
+#define EEPROM_APP_CRC_START	(EEPROM_LENGTH - 6) // CRC-16 of the app, kept by the bootloader
 
 typedef enum _Light_Protocol_Parameter {
     PARAM_BIAS_RED,             // 0
@@ -54,7 +55,11 @@ typedef enum _Light_Protocol_Parameter {
     PARAM_MACRO,                // 9
     PARAM_RESET,                // 10
     PARAM_APP_CHECKSUM,         // 11
-    PARAM_ENUM_COUNT            // 12
+    PARAM_GAMMA,                // 12
+    PARAM_SYNC_STATS,           // 13
+    PARAM_APPLY_ON_SYNC,        // 14
+    PARAM_SKIP_COUNT,           // 15
+    PARAM_ENUM_COUNT            // 16
 } LightProtocolParameter;
 
 typedef enum _Light_Param_Macro {
@@ -69,22 +74,39 @@ typedef enum _Light_Param_Macro {
     PARAM_MACRO_ENUM_COUNT          // 8
 } LightParamMacro;
 
-static const short int LightParameterSize[PARAM_ENUM_COUNT] = {
-    1,  // Bias 
-    1,  // Bias 
-    1,  // Bias   
-    1,  // Amp 
-    1,  // Amp 
-    1,  // Amp 
-    2,  // Period
-    1,  // Repeat
-    2,  // Phase Offset
-    1,  // Param Macro
-    1,  // Param Reset
-};
+// channels of a parameter descriptor, bit 0 == red
+#define LPP_CHANNEL_RED         0x01
+#define LPP_CHANNEL_GREEN       0x02
+#define LPP_CHANNEL_BLUE        0x04
+#define LPP_CHANNEL_ALL         0x07
+
+// generator fields written by the frames of a staged set, the
+//   others keep the value of the live generator when committed
+#define LPP_STAGED_CYCLES       0x01    // cyclesRemaining
+#define LPP_STAGED_VALUE        0x02    // value
+
+// decodes a received parameter value in place, returns 0 if
+//   nothing is to be stored (invalid value, or a command)
+typedef uint8_t (*LightParamConverter)(uint16_t*);
+
+// how a parameter is decoded from the frame and applied, the
+//   table (see light_pattern_protocol.c) is kept in program memory
+typedef struct _Light_Param_Descriptor {
+    uint8_t size;                   // value bytes in the frame, msb first
+    uint8_t field;                  // offset of the PatternGenerator field
+    uint8_t width;                  // field bytes, 1 or 2
+    uint8_t channels;               // LPP_CHANNEL_* stored to, 0 for a command
+    LightParamConverter convert;    // NULL stores the value as received
+} LightParamDescriptor;
+
+// PARAM_GAMMA value, selects the brightness curve (WaveformGammaCurve)
+//   of the channels in the upper nibble, bit 4 == red. A zero channel
+//   mask applies the curve to all channels
+#define GAMMA_CURVE_MASK        0x0F
+#define GAMMA_CHANNEL_SHIFT     4
+#define GAMMA_CHANNEL_ALL       0x07
 
 typedef struct _Light_Pattern_Protocol {
-    uint8_t isCommandFresh;
 	int8_t	cyclesRemaining;
     PatternGenerator* redPattern;
     PatternGenerator* greenPattern;
@@ -95,8 +117,24 @@ LightPatternProtocol LPP_pattern_protocol;
 
 uint8_t LPP_processBuffer(void);
 void LPP_setParamMacro(LightParamMacro);
-void _LPP_processParameterUpdate(LightProtocolParameter, int);
+void LPP_onSync(void);
+void LPP_discardStaged(void);
+uint8_t _LPP_isFrameValid(uint8_t);
+void _LPP_beginFrame(void);
+void _LPP_endFrame(void);
+void _LPP_commit(void);
+void _LPP_processParameterUpdate(LightProtocolParameter, uint8_t);
 void _LPP_setPattern(int);
+void _LPP_markDirty(void);
+uint8_t _LPP_toSpeed(uint16_t*);
+uint8_t _LPP_toAngle(uint16_t*);
+uint8_t _LPP_runMacro(uint16_t*);
+uint8_t _LPP_runReset(uint16_t*);
+uint8_t _LPP_replyChecksum(uint16_t*);
+uint8_t _LPP_setGamma(uint16_t*);
+uint8_t _LPP_replySyncStats(uint16_t*);
+uint8_t _LPP_deferToSync(uint16_t*);
+uint8_t _LPP_replySkipCount(uint16_t*);
 
 
 #endif
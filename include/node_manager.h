@@ -14,7 +14,7 @@
 **********************************************************************/
 
 
-#include <avr/io.h>
+#include "hal.h"
 #include "pattern_generator.h"
 
 // node status:
@@ -11,6 +11,15 @@
     ...where x is some speed and phase adjusted time domain 
     ...where f() is a carrier function determined by the pattern 
 
+    Generators whose output can not change (a solid colour, or a 
+    pattern which has run out of cycles) are not re-evaluated until 
+    they are marked dirty by a parameter change, see PG_markDirty().
+
+    All computation is fixed point. Angles (theta, phase and the clock
+    position) are 16-bit binary angles, where a full revolution of 2*pi
+    radians is 0x10000, so wrapping is free on overflow. Carrier 
+    functions are shared through carrier.h and return Q14 values.
+
 
 
   Authors: 
@@ -48,13 +57,14 @@ typedef struct _Pattern_Generator_State {
     
     int8_t cyclesRemaining; 
     PatternEnum pattern;
-    double theta;
+    uint16_t theta;
     uint8_t speed;
-    double phase;
-    double amplitude;
+    uint16_t phase;
+    uint8_t amplitude;
     uint8_t bias;
     uint8_t value;
     uint8_t isNewCycle;
+    uint8_t isDirty;        // parameters changed since the last evaluation
 
 } PatternGenerator;
 
@@ -65,14 +75,15 @@ PatternGenerator pgGreen;
 PatternGenerator pgBlue;
 
 void PG_init(PatternGenerator*);
-void PG_calc(PatternGenerator*, double);
-void _PG_calcTheta(PatternGenerator*, double);
-void _PG_patternOff(PatternGenerator*);
-void _PG_patternSolid(PatternGenerator*);
-void _PG_patternStrobe(PatternGenerator*);
-void _PG_patternSine(PatternGenerator*);
-void _PG_patternSiren(PatternGenerator*);
-void _PG_patternFadeIn(PatternGenerator*);
-void _PG_patternFadeOut(PatternGenerator*);
+void PG_calc(PatternGenerator*, uint16_t);
+void PG_calcGroup(PatternGenerator**, uint8_t, uint16_t);
+void PG_markDirty(PatternGenerator*);
+uint16_t PG_getSkipCount(void);
+uint8_t _PG_isSteady(PatternGenerator*);
+uint8_t _PG_isSameTimeDomain(PatternGenerator*, PatternGenerator*);
+uint8_t _PG_advance(PatternGenerator*, uint16_t);
+int16_t _PG_carrier(PatternGenerator*);
+void _PG_apply(PatternGenerator*, int16_t);
+uint8_t _PG_saturate(int32_t);
 
 #endif
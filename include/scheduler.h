@@ -0,0 +1,41 @@
+/**********************************************************************
+
+  scheduler.h - event flags for the application mainloop. Interrupt
+    handlers post events as they happen; the mainloop waits for them,
+    sleeping in idle mode while there is nothing to do, and handles
+    each batch of events once.
+
+    Events are bits, so several posts of the same event before the
+    mainloop wakes up are merged into one.
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#ifndef  SCHEDULER_H
+#define  SCHEDULER_H
+
+#include "utilities.h"
+
+// mainloop events
+#define SCHED_EVENT_CLOCK_TICK      0b00000001 // synchro clock advanced
+#define SCHED_EVENT_COMMAND         0b00000010 // TWI command received
+#define SCHED_EVENT_STARTUP_FAIL    0b00000100 // startup comms timeout
+#define SCHED_EVENT_SYNC            0b00001000 // general call sync pulse
+
+// scheduler state structure
+typedef struct _Scheduler_State {
+    volatile uint8_t pendingEvents;
+} Scheduler;
+
+void SCHED_init(void);
+void SCHED_post(uint8_t);
+uint8_t SCHED_take(void);
+uint8_t SCHED_wait(void);
+
+#endif
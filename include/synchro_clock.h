@@ -13,6 +13,18 @@
     To advance the clock, call updateClock(). Any phase adjustments which
       were previously computed will be automatically applied.
 
+    Phase correction is a PI loop. The proportional term slews the clock
+      towards the phase signal over the following ticks, and the integral
+      term estimates the frequency error of the node oscillator from the
+      phase error seen over each sync period, and trims the tick increment
+      to cancel it. A node far out of phase (at startup, for example) is 
+      stepped directly onto the phase signal instead of slewed.
+
+    Statistics of the phase signals since the last reset (phase error,
+      ticks between signals and the correction applied) are kept as 
+      running counters for tuning the sync interval, see 
+      SYNCLK_getSyncStats().
+
 
   Authors: 
     Nate Fisher
@@ -27,36 +39,143 @@
 
 #include "utilities.h"
 
-// TODO: make an init function to handle these calculations
-// creates a synchronization period of exactly 4s with:
+// clock ticks are timer1 overflows, must match the timer1 config
+//  in _WG_configureHardware: fast 8-bit PWM, clock divided by 8
+#define SYNCLK_TIMER_PRESCALER      8UL
+#define SYNCLK_TIMER_PERIOD         256UL
+
+// synchronization period, the interval of the general call phase signal
+#define SYNCLK_PERIOD_MS            4000UL
+
+// the clock period and increment are derived from the above, at 8MHz:
 //  - ticks (timer overflows) at 3906.25 Hz
 //       8Mhz (CPU) / 8 (TCCR1B div) / 256 (PWM-8bit)
 //  - 3906.25/s * 4s = 15625 ticks in 4s period
-//  - increment by 4 each tick yields a clock TOP size of 62500
-static const double _SYNCLK_CLOCK_RESET             = 0;
-static const double _SYNCLK_CLOCK_TOP               = 62500;
-static const double _SYNCLK_TICK_INCREMENT          = 4;
+//  - the clock TOP is the 16-bit binary angle of the clock position,
+//    65536, for an increment of 65536 / 15625 = 4.194304 per tick
+//  clock time is kept in Q16 fixed point units of these, so the
+//  increment can be trimmed by a fraction of a unit per tick. The
+//  Q16 clock fills 32 bits exactly: it wraps at TOP by itself, and 
+//  the position is its integer part. The increment is rounded to
+//  the nearest Q16 unit (0.34ppm fast), which the loop trims out
+#define _SYNCLK_TICKS_PER_PERIOD    ((F_CPU / 1000UL) * SYNCLK_PERIOD_MS / \
+                                        (SYNCLK_TIMER_PRESCALER * SYNCLK_TIMER_PERIOD))
+#define _SYNCLK_CLOCK_TOP           0x10000UL
+#define _SYNCLK_TICK_INCREMENT_Q16  (((_SYNCLK_CLOCK_TOP / _SYNCLK_TICKS_PER_PERIOD) << 16) + \
+                                        (((_SYNCLK_CLOCK_TOP % _SYNCLK_TICKS_PER_PERIOD) << 16) + \
+                                            _SYNCLK_TICKS_PER_PERIOD / 2) / _SYNCLK_TICKS_PER_PERIOD)
+
+#if ((F_CPU / 1000UL) * SYNCLK_PERIOD_MS) % (SYNCLK_TIMER_PRESCALER * SYNCLK_TIMER_PERIOD) != 0
+#error "SYNCLK_PERIOD_MS must be a whole number of timer1 overflows"
+#endif
+
+#if _SYNCLK_TICKS_PER_PERIOD >= _SYNCLK_CLOCK_TOP
+#error "SYNCLK_PERIOD_MS is too long for a 16-bit clock"
+#endif
+
+// fastest phase slew, as a change of the tick increment (+/-50%)
+#define _SYNCLK_SLEW_MAX_Q16        (_SYNCLK_TICK_INCREMENT_Q16 / 2)
 
-// TODO: make a setter routine  to adjust agressiveness
-static const double _SYNCLK_CORRECTION_THRESHOLD    = 2;
+// phase error beyond which the clock is stepped instead of slewed, 1/16
+//  of a period (0.25s) takes 0.5s to slew at the fastest rate
+#define _SYNCLK_STEP_THRESHOLD_Q16  ((_SYNCLK_CLOCK_TOP / 16) << 16)
+
+// largest frequency trim, as a change of the tick increment (+/-12.5%)
+#define _SYNCLK_TRIM_MAX_Q16        (_SYNCLK_TICK_INCREMENT_Q16 / 8)
+
+// default loop gains, Q8 (256 == 1.0), see SYNCLK_setGains()
+#ifndef SYNCLK_KP_DEFAULT
+#define SYNCLK_KP_DEFAULT           256
+#endif
+#ifndef SYNCLK_KI_DEFAULT
+#define SYNCLK_KI_DEFAULT           192
+#endif
+
+// Q16 clock units per microsecond, for statistics (1073.7, truncated)
+#define _SYNCLK_Q16_PER_US          ((_SYNCLK_CLOCK_TOP << 15) / (SYNCLK_PERIOD_MS * 500UL))
+
+// running statistics of the phase signals since the last reset, 
+//  count stops at UINT16_MAX and the rest with it
+typedef struct _Sync_Stats_Counters {
+    int32_t phaseErrorSum;      // us, positive if ahead
+    uint32_t intervalSum;       // ticks
+    uint16_t count;             // phase signals
+    int16_t phaseErrorMin;      // us, saturated
+    int16_t phaseErrorMax;      // us, saturated
+    uint16_t intervalMin;       // ticks since the previous phase signal
+    uint16_t intervalMax;       // ticks
+    uint16_t correctionAdded;   // us added to the clock, saturated
+    uint16_t correctionRemoved; // us removed from the clock, saturated
+} SyncStatsCounters;
+
+// summary of the statistics, see SYNCLK_getSyncStats()
+typedef struct _Sync_Stats {
+    uint8_t count;              // phase signals since the reset, saturated
+    uint8_t stepCount;          // clock steps since init, wraps
+    int16_t phaseErrorMin;      // us
+    int16_t phaseErrorMax;      // us
+    int16_t phaseErrorMean;     // us
+    uint16_t intervalMin;       // ticks
+    uint16_t intervalMax;       // ticks
+    uint16_t intervalMean;      // ticks
+    uint16_t correctionAdded;   // us added to the clock (ticks added)
+    uint16_t correctionRemoved; // us removed from the clock (ticks skipped)
+    int16_t frequencyTrim;      // ppm
+} SyncStats;
 
 // synchro clock state structure
+//  members marked ISR are written by the timer1 or TWI ISR and read 
+//  by the mainloop as a snapshot: the ISRs bump clockSequence after
+//  every update, and the mainloop repeats a read until clockSequence
+//  is unchanged across it. ISRs do not nest and the mainloop can not
+//  interrupt them, so a read which saw no change is consistent
+//  members marked MAIN are written by the mainloop and handed to the
+//  timer1 ISR through a single byte (tickStepIndex, isClockShiftPending)
 typedef struct _Syncro_Clock_State {
-    void (*recordPhaseError)();
     char isPhaseCorrectionUpdated;
-    int16_t clockSkips;
-    int16_t nodePhaseError;
-    int16_t nodeTimeOffset;
-    uint32_t nodeTime;
+    char isSyncIntervalValid;               // a previous phase signal was processed
+    uint8_t stepCount;
+    uint8_t phaseSignalsTaken;              // phase signals processed by the mainloop
+    volatile uint8_t clockSequence;         // ISR: bumped after each update
+    volatile uint8_t phaseSignalCount;      // ISR: phase signals recorded
+    volatile uint8_t tickStepIndex;         // MAIN: tickStep in use by the ISR
+    volatile uint8_t isClockShiftPending;   // MAIN: clockShift not yet applied
+    uint16_t kp;                            // proportional gain, Q8
+    uint16_t ki;                            // integral gain, Q8
+    uint16_t ticksSinceSync;
+    uint16_t capturedTicks;                 // ISR: ticksSinceSync at the general call
+    uint32_t capturedTime;                  // ISR: Q16 clock time at the general call
+    volatile uint16_t syncInterval;         // ISR: ticks between the last two phase signals
+    int32_t phaseCorrection;                // Q16 clock units left to slew
+    int32_t frequencyTrim;                  // Q16 clock units added to each tick
+    int32_t correctionApplied;              // Q16 clock units slewed or stepped since the phase signal
+    SyncStatsCounters stats;
+    volatile int32_t clockShift;            // MAIN: Q16 clock step
+    volatile uint32_t tickStep[2];          // MAIN: Q16 clock units per tick
+    volatile uint32_t nodeTimeOffset;       // ISR: Q16 clock time at the phase signal
+    volatile uint32_t nodeTime;             // ISR: Q16 clock time
 } SyncroClock;
 
 void SYNCLK_init(void);
-double SYNCLK_getClockPosition(void);
+void SYNCLK_setGains(uint16_t, uint16_t);
+uint16_t SYNCLK_getClockPosition(void);
 void SYNCLK_updateClock(void);
 void SYNCLK_recordPhaseError(void);
+void SYNCLK_capturePhaseSignal(void);
+void SYNCLK_commitPhaseSignal(void);
 void SYNCLK_calcPhaseCorrection(void);
-void _SYNCLK_clockTick(void);
-void _SYNCLK_clockSkip(void);
+void SYNCLK_getSyncStats(SyncStats*);
+void SYNCLK_resetSyncStats(void);
+void _SYNCLK_updateLoop(uint32_t, uint16_t);
+uint32_t _SYNCLK_shiftClock(uint32_t, int32_t);
+void _SYNCLK_recordStats(int32_t, uint16_t);
+int16_t _SYNCLK_toMicroseconds(int32_t);
 void _SYNCLK_setPhaseCorrectionStale(void);
+#ifdef HOST_BUILD
+void SYNCLK_swapState(SyncroClock*);
+#endif
+#ifdef SYNCLK_STRESS_TEST
+void SYNCLK_stressTest(void);
+#endif
 
 #endif
@@ -75,17 +75,60 @@
 // Reset bit pattern for TWI control register
 #define TWCR_RESET	TWCR_TWINT | TWCR_TWIE | TWCR_TWEA | TWCR_TWEN
 
-// TWI buffer
-#define TWI_MAX_BUFFER_SIZE 100
-uint8_t TWI_Ptr;
-uint8_t TWI_Buffer[TWI_MAX_BUFFER_SIZE];
+// maximum frame length, including the transmitted XOR. The longest
+//   real frame sets the pattern and every pattern parameter once, plus
+//   PARAM_GAMMA and PARAM_APPLY_ON_SYNC: 24 bytes and the XOR
+#define TWI_MAX_BUFFER_SIZE 28
+
+// TWI receive queue
+//   frames received by the ISR are queued until the mainloop parses
+//   them, so a burst of commands within one tick is not overwritten.
+//   each frame is stored as its length, its calculated XOR and then
+//   the command bytes (transmitted XOR removed), wrapping around the
+//   end of the ring. head is only written by the ISR and tail only by
+//   the mainloop, both free running, so the queue needs no locking.
+//   the largest real burst is a staged frame followed by the frame 
+//   which commits it, parsed together by the next mainloop pass
+#define TWI_QUEUE_SIZE      64      // bytes, power of 2 and at most 128
+#define TWI_QUEUE_MASK      (TWI_QUEUE_SIZE - 1)
+#define TWI_FRAME_HEADER    2       // length, calculated XOR
+
+#if (TWI_QUEUE_SIZE & TWI_QUEUE_MASK) || TWI_QUEUE_SIZE > 128
+#error "TWI_QUEUE_SIZE must be a power of 2 no larger than 128"
+#endif
+#if 2 * (TWI_MAX_BUFFER_SIZE - 1 + TWI_FRAME_HEADER) > TWI_QUEUE_SIZE
+#error "TWI_QUEUE_SIZE cannot hold two frames of TWI_MAX_BUFFER_SIZE"
+#endif
+
+typedef struct _TWI_Queue {
+    volatile uint8_t buffer[TWI_QUEUE_SIZE];
+    volatile uint8_t head;          // ISR: end of the last complete frame
+    volatile uint8_t tail;          // MAIN: start of the oldest frame
+    volatile uint8_t framesDropped; // ISR: frames too long or lost to a full queue
+} TWIQueue;
+
+// broadcast, general call data
+//   a general call without data is the sync pulse. with data it
+//   carries records of station mask (bit n == station n), length
+//   and that many command bytes, followed by the XOR of all the
+//   data. the records for this station are queued as frames
+#define TWI_RECORD_START    0       // no data received yet
+#define TWI_RECORD_MASK     1
+#define TWI_RECORD_LENGTH   2
+#define TWI_RECORD_DATA     3
+
+TWIQueue TWI_queue;
 uint8_t TWI_transmittedXOR;
 uint8_t TWI_calculatedXOR;
 uint8_t TWI_ReplyLen;
-uint8_t TWI_ReplyBuf[8];
+uint8_t TWI_ReplyBuf[24];
 
-char* TWI_getBuffer(void);
-uint8_t TWI_getBufferSize(void);
+uint8_t TWI_peekFrame(void);
+uint8_t TWI_frameByte(uint8_t);
+uint8_t TWI_frameXOR(void);
+void TWI_popFrame(void);
+uint8_t TWI_getDropCount(void);
 void TWI_init(uint8_t);
+void _TWI_receiveBroadcast(uint8_t);
 
 #endif
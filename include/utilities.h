@@ -24,6 +24,12 @@ static inline double UTIL_degToRad(double degrees) {
     return (degrees / 360.0) * 2.0 * _PI;
 }
 
+// convert degrees to a 16-bit binary angle (0x10000 == 360 degrees),
+//   angles beyond a full revolution wrap
+static inline uint16_t UTIL_degToAngle(uint16_t degrees) {
+    return ((uint32_t)degrees << 16) / 360;
+}
+
 static inline uint16_t UTIL_charToInt(char msb, char lsb) {
     return ( ( (0x00FF & (uint16_t)msb) << 8) | (0x00FF & (uint16_t)lsb) );
 }
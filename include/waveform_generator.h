@@ -26,6 +26,8 @@
 #define TIMSK0_OCIE0B         0b00000100
 #define TIMSK0_OCIE0A         0b00000010
 #define TIMSK0_TOIE0          0b00000001
+#define TIFR0_OCF0B           0b00000100
+#define TIFR0_TOV0            0b00000001
 
 #define TCCR1A_PWM_MODE       0b10100000
 #define TCCR1A_FAST_PWM8      0b00000001
@@ -45,18 +47,89 @@
 
 #define PWM_BLUE_MIN_VALUE		6
 
+// temporal dithering; the fractional part of each channel value is
+//   carried by a sigma-delta accumulator, which raises the output by
+//   one count in that fraction of PWM periods. Gives PWM_DITHER_BITS
+//   of extra resolution; 0 disables dithering, the default. Above 5 
+//   bits, the slowest dither cycle falls below ~120Hz and may be visible
+#ifndef PWM_DITHER_BITS
+#define PWM_DITHER_BITS         0
+#endif
+
+// fractional bits kept in a frame
+#define WG_DITHER_MASK          ((uint16_t)(0xFFFF << (8 - PWM_DITHER_BITS)))
+
+// channel 3 (timer0) PWM period, in timer1 PWM periods
+//   timer0 CLOCK_DIV64 / timer1 CLOCK_DIV8
+#define WG_TIMER0_PERIOD_TICKS  8
+
+#if PWM_MAX_VALUE > 255 || PWM_BLUE_MIN_VALUE >= PWM_MAX_VALUE
+#error "PWM_MAX_VALUE must fit 8 bits and exceed PWM_BLUE_MIN_VALUE"
+#endif
+
+#if PWM_MAX_VALUE > 254 && PWM_DITHER_BITS > 0
+#error "dithering needs PWM_MAX_VALUE + 1 to fit 8 bits"
+#endif
+
+#if PWM_DITHER_BITS > 8
+#error "PWM_DITHER_BITS must be 0 to 8"
+#endif
+
+// rescale a 16-bit output level (see WG_updatePWM) onto 0..range 
+//   PWM counts, the result carries 8 fractional bits. For a linear 
+//   level (value << 8) the integer part is (value / 256.0) * range
+//   truncated
+#define WG_SCALE_LEVEL(level, range) \
+    ((uint16_t)((uint16_t)((level) >> 8) * (range) + \
+        (((uint16_t)((level) & 0xFF) * (range)) >> 8)))
+
+// brightness correction curves, applied per channel between the
+//   pattern generator value and the PWM registers. The tables are 
+//   generated at build time (tools/gen_gamma.py, GAMMA_CURVES in
+//   the Makefile) in the order listed here, following LINEAR. A build
+//   may leave out the curves at the end of the list
+typedef enum _Waveform_Gamma_Curve {
+    WG_GAMMA_LINEAR,        // 0
+    WG_GAMMA_2_2,           // 1
+    WG_GAMMA_CIE,           // 2
+    WG_GAMMA_ENUM_COUNT     // 3
+} WaveformGammaCurve;
+
+// port B output pins for each channel
+#define WG_CHANNEL_1_PIN      0b00000100 // PB2, OC1B
+#define WG_CHANNEL_2_PIN      0b00000010 // PB1, OC1A
+#define WG_CHANNEL_3_PIN      0b00000001 // PB0, bit banged
+#define WG_CHANNEL_3_BIT      0          // PB0, for sbi/cbi
+
+// a complete set of output values, published by the mainloop
+//   and latched by the timer overflow ISR at the PWM period boundary
+//   values are PWM counts with 8 fractional bits, used for dithering
+typedef struct _Waveform_Frame {
+    uint16_t channel_pwm[3];
+} WaveformFrame;
+
 typedef struct _Waveform_Generator_State {
     volatile uint8_t* channel_1_output;
     volatile uint8_t* channel_2_output;
     uint8_t channel_3_output;
     uint8_t channel_3_enable;
     uint8_t* channel_target[3];
+    uint8_t gammaCurve[3];
     void (*overflowCallback)();
+    volatile WaveformFrame frame[2];
+    volatile uint8_t frameIndex;        // last published frame
+    volatile uint8_t isFramePending;    // published but not yet latched
+    uint8_t ditherError[3];             // sigma-delta accumulators
+    uint8_t channel_3_ticks;            // timer1 periods into the timer0 period
 } WaveformGenerator;
 
 void WG_init(uint8_t**, int);
 void WG_onOverflow(void(*)());
 void WG_updatePWM(void);
+void WG_setGammaCurve(uint8_t, WaveformGammaCurve);
+uint16_t _WG_channelLevel(uint8_t);
 void _WG_configureHardware(void);
+void _WG_latchFrame(void);
+uint8_t _WG_ditherChannel(uint8_t, uint16_t);
 
 #endif
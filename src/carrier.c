@@ -0,0 +1,60 @@
+/**********************************************************************
+
+  carrier.c - implementation, see header for description
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include "hal.h"
+#include "carrier.h"
+
+// sin(i * pi/128) for i = 0..64, Q14
+//   round(sin(i * pi / 128) * 16384)
+static const uint16_t _CARRIER_sineTable[CARRIER_TABLE_SIZE] PROGMEM = {
+        0,   402,   804,  1205,  1606,  2006,  2404,  2801,
+     3196,  3590,  3981,  4370,  4756,  5139,  5520,  5897,
+     6270,  6639,  7005,  7366,  7723,  8076,  8423,  8765,
+     9102,  9434,  9760, 10080, 10394, 10702, 11003, 11297,
+    11585, 11866, 12140, 12406, 12665, 12916, 13160, 13395,
+    13623, 13842, 14053, 14256, 14449, 14635, 14811, 14978,
+    15137, 15286, 15426, 15557, 15679, 15791, 15893, 15986,
+    16069, 16143, 16207, 16261, 16305, 16340, 16364, 16379,
+    16384,
+};
+
+// sine of a binary angle, Q14 result
+int16_t CARRIER_sin(uint16_t angle) {
+
+    // fold the angle onto the first quadrant (0 ~ 0x4000)
+    uint16_t z = angle & 0x3FFF;
+    if (angle & 0x4000) z = 0x4000 - z;
+
+    // upper bits select the table segment, the lower 
+    //   bits interpolate within it. The fraction is cut to 7 bits
+    //   so the product fits in an unsigned 16-bit multiply
+    uint8_t index = z >> 8;
+    uint8_t fraction = (z & 0xFF) >> 1;
+
+    uint16_t y = pgm_read_word(&_CARRIER_sineTable[index]);
+    if (fraction) {
+        uint16_t delta = pgm_read_word(&_CARRIER_sineTable[index + 1]) - y;
+        y += (delta * fraction) >> 7;
+    }
+
+    // second half of the revolution is negative
+    return (angle & 0x8000) ? -(int16_t)y : (int16_t)y;
+
+}
+
+// cosine of a binary angle, Q14 result
+int16_t CARRIER_cos(uint16_t angle) {
+
+    return CARRIER_sin(angle + 0x4000);
+
+}
@@ -11,84 +11,201 @@
 
 **********************************************************************/
 
-#include <avr/io.h>
-#include <avr/wdt.h>
-#include <avr/eeprom.h>
+#include "hal.h"
+#include <stddef.h>
 #include "light_pattern_protocol.h"
 #include "pattern_generator.h"
 #include "utilities.h"
 #include "node_manager.h"
 #include "twi_manager.h"
+#include "waveform_generator.h"
 
 extern uint8_t NODE_station;
-extern uint8_t TWI_Ptr;
-extern uint8_t TWI_Buffer[];
 extern uint8_t TWI_transmittedXOR;
 extern uint8_t TWI_calculatedXOR;
 extern uint8_t TWI_ReplyBuf[];
 extern uint8_t TWI_ReplyLen;
 
+// parameter decoding, indexed by LightProtocolParameter
+//   a new parameter only needs its row here (and its converter)
+static const LightParamDescriptor _LPP_descriptors[PARAM_ENUM_COUNT] PROGMEM = {
+    // size, field, width, channels, convert
+    {1, offsetof(PatternGenerator, bias),            1, LPP_CHANNEL_RED,    NULL},                  // PARAM_BIAS_RED
+    {1, offsetof(PatternGenerator, bias),            1, LPP_CHANNEL_GREEN,  NULL},                  // PARAM_BIAS_GREEN
+    {1, offsetof(PatternGenerator, bias),            1, LPP_CHANNEL_BLUE,   NULL},                  // PARAM_BIAS_BLUE
+    {1, offsetof(PatternGenerator, amplitude),       1, LPP_CHANNEL_RED,    NULL},                  // PARAM_AMPLITUDE_RED
+    {1, offsetof(PatternGenerator, amplitude),       1, LPP_CHANNEL_GREEN,  NULL},                  // PARAM_AMPLITUDE_GREEN
+    {1, offsetof(PatternGenerator, amplitude),       1, LPP_CHANNEL_BLUE,   NULL},                  // PARAM_AMPLITUDE_BLUE
+    {2, offsetof(PatternGenerator, speed),           1, LPP_CHANNEL_ALL,    _LPP_toSpeed},          // PARAM_PERIOD
+    {1, offsetof(PatternGenerator, cyclesRemaining), 1, LPP_CHANNEL_ALL,    NULL},                  // PARAM_REPEAT
+    {2, offsetof(PatternGenerator, phase),           2, LPP_CHANNEL_ALL,    _LPP_toAngle},          // PARAM_PHASEOFFSET
+    {1, 0,                                           0, 0,                  _LPP_runMacro},         // PARAM_MACRO
+    {1, 0,                                           0, 0,                  _LPP_runReset},         // PARAM_RESET
+    {0, 0,                                           0, 0,                  _LPP_replyChecksum},    // PARAM_APP_CHECKSUM
+    {1, 0,                                           0, 0,                  _LPP_setGamma},         // PARAM_GAMMA
+    {0, 0,                                           0, 0,                  _LPP_replySyncStats},   // PARAM_SYNC_STATS
+    {0, 0,                                           0, 0,                  _LPP_deferToSync},      // PARAM_APPLY_ON_SYNC
+    {0, 0,                                           0, 0,                  _LPP_replySkipCount},   // PARAM_SKIP_COUNT
+};
+
+// frames are parsed into a staged copy of the pattern generators,
+//   which is committed once the whole frame has been applied, or
+//   at the next sync pulse if the frame asks for PARAM_APPLY_ON_SYNC
+static PatternGenerator _LPP_staged[3];
+static PatternGenerator* _LPP_live[3];
+static uint8_t _LPP_isStagePending;     // staged set waits for the sync
+static uint8_t _LPP_isApplyOnSync;      // frame being parsed waits for the sync
+static uint8_t _LPP_stagedFields;       // LPP_STAGED_* written since the stage began
+
 uint8_t LPP_processBuffer(void) {
     // return true if command was processed
     uint8_t processed_retval = 0;
+    uint8_t frame_length;
         
-    // if command is new, re-parse
-    // ensure valid length buffer
-    // ensure pointer is valid
-    if (TWI_Ptr > 0 &&
-        LPP_pattern_protocol.isCommandFresh) {
+    // parse every queued command in the order received,
+    //   a burst within one tick is applied in full
+    while ((frame_length = TWI_peekFrame()) > 0) {
 
         // signal startup 
         processed_retval = 1;
 
-        // set pattern if command is not a param-only command
-        if (TWI_Buffer[0] != PATTERN_PARAMUPDATE) {
-            _LPP_setPattern(TWI_Buffer[0]);
-		}
-
-        // cycle through remaining params
-        // beginning with first param (following pattern byte)
-        uint8_t buffer_pointer = 1;
-        while (buffer_pointer < TWI_Ptr) {
-
-            // digest parameters serially
-            LightProtocolParameter currParam;
-
-            // ensure parameter is valid, stop parsing if invalid
-            //    this means that part of a message can be parsed, until
-            //    an invalid parameter is seen
-            if (TWI_Buffer[buffer_pointer] < PARAM_ENUM_COUNT &&
-                TWI_Buffer[buffer_pointer] >= 0) {
-                currParam = TWI_Buffer[buffer_pointer];
-            } else {
-                break;
+        // a frame is applied in full or not at all
+        if (_LPP_isFrameValid(frame_length)) {
+
+            _LPP_beginFrame();
+
+            // set pattern if command is not a param-only command
+            if (TWI_frameByte(0) != PATTERN_PARAMUPDATE) {
+                _LPP_setPattern(TWI_frameByte(0));
             }
 
-            // get size of parameter value
-            int paramSize = LightParameterSize[currParam];
+            // digest parameters serially, beginning with
+            //   the first param (following pattern byte)
+            uint8_t buffer_pointer = 1;
+            while (buffer_pointer < frame_length) {
+                LightProtocolParameter currParam = TWI_frameByte(buffer_pointer);
 
-            // ensure buffer is long enough
-            //   stop parsing if remaining buffer length does 
-            //   not have enough room for this parameter
-            //   ('size-1' accounts for pattern byte)
-            if (buffer_pointer + paramSize > TWI_Ptr-1) break;
+                _LPP_processParameterUpdate(currParam, buffer_pointer+1);
 
-            // implement parameter+value update 
-            _LPP_processParameterUpdate(currParam, buffer_pointer+1);
+                buffer_pointer += pgm_read_byte(&_LPP_descriptors[currParam].size) + 1;
+            }
 
-            // advance pointer
-            buffer_pointer += paramSize + 1;
+            _LPP_endFrame();
         }
 
+        // release the frame to the TWI ISR
+        TWI_popFrame();
     }
 
-    // signal command has been parsed
-    LPP_pattern_protocol.isCommandFresh = 0;
+    // generators are re-evaluated after any command
+    if (processed_retval) _LPP_markDirty();
 
     return processed_retval;
 
 }
 
+// commit frames staged with PARAM_APPLY_ON_SYNC, called from the
+//   mainloop on the sync pulse so every node changes on the same tick
+void LPP_onSync(void) {
+
+    if (!_LPP_isStagePending) return;
+
+    _LPP_commit();
+    _LPP_markDirty();
+
+}
+
+// drop frames waiting for the sync, called before the live
+//   generators are set directly so the sync cannot undo it
+void LPP_discardStaged(void) {
+
+    _LPP_isStagePending = 0;
+
+}
+
+// check the whole frame before any of it is applied, every
+//   parameter must be known and have its complete value
+uint8_t _LPP_isFrameValid(uint8_t length) {
+
+    uint8_t buffer_pointer = 1;
+
+    while (buffer_pointer < length) {
+        uint8_t param = TWI_frameByte(buffer_pointer);
+        if (param >= PARAM_ENUM_COUNT) return 0;
+
+        buffer_pointer += pgm_read_byte(&_LPP_descriptors[param].size) + 1;
+    }
+
+    return buffer_pointer == length;
+
+}
+
+// point the protocol at the staged generators, a copy of the live
+//   ones unless earlier frames are already waiting for the sync
+void _LPP_beginFrame(void) {
+
+    _LPP_live[0] = LPP_pattern_protocol.redPattern;
+    _LPP_live[1] = LPP_pattern_protocol.greenPattern;
+    _LPP_live[2] = LPP_pattern_protocol.bluePattern;
+
+    if (!_LPP_isStagePending) {
+        uint8_t i;
+        for (i = 0; i < 3; i++) _LPP_staged[i] = *_LPP_live[i];
+        _LPP_stagedFields = 0;
+    }
+
+    LPP_pattern_protocol.redPattern = &_LPP_staged[0];
+    LPP_pattern_protocol.greenPattern = &_LPP_staged[1];
+    LPP_pattern_protocol.bluePattern = &_LPP_staged[2];
+
+    _LPP_isApplyOnSync = 0;
+
+}
+
+void _LPP_endFrame(void) {
+
+    LPP_pattern_protocol.redPattern = _LPP_live[0];
+    LPP_pattern_protocol.greenPattern = _LPP_live[1];
+    LPP_pattern_protocol.bluePattern = _LPP_live[2];
+
+    // a frame without PARAM_APPLY_ON_SYNC commits any
+    //   frames staged before it as well
+    if (_LPP_isApplyOnSync)
+        _LPP_isStagePending = 1;
+    else
+        _LPP_commit();
+
+}
+
+// copy the staged generators to the live ones
+void _LPP_commit(void) {
+
+    PatternGenerator* live[] = {
+        LPP_pattern_protocol.redPattern,
+        LPP_pattern_protocol.greenPattern,
+        LPP_pattern_protocol.bluePattern
+    };
+
+    uint8_t i;
+    for (i = 0; i < 3; i++) {
+        // the live generators kept running while the staged
+        //   set waited for the sync, keep their position and
+        //   the state the staged frames did not set
+        if (_LPP_isStagePending) {
+            _LPP_staged[i].theta = live[i]->theta;
+            _LPP_staged[i].isNewCycle = live[i]->isNewCycle;
+            if (!(_LPP_stagedFields & LPP_STAGED_CYCLES))
+                _LPP_staged[i].cyclesRemaining = live[i]->cyclesRemaining;
+            if (!(_LPP_stagedFields & LPP_STAGED_VALUE))
+                _LPP_staged[i].value = live[i]->value;
+        }
+        *live[i] = _LPP_staged[i];
+    }
+
+    _LPP_isStagePending = 0;
+
+}
+
 void _LPP_setPattern(int patternEnum) {
 
     // if changing to fadein/fadeout, set cycles to 1
@@ -100,6 +217,7 @@ void _LPP_setPattern(int patternEnum) {
             LPP_pattern_protocol.redPattern->cyclesRemaining = 1;
             LPP_pattern_protocol.greenPattern->cyclesRemaining = 1;
             LPP_pattern_protocol.bluePattern->cyclesRemaining = 1;
+            _LPP_stagedFields |= LPP_STAGED_CYCLES;
 
     }
 
@@ -110,90 +228,184 @@ void _LPP_setPattern(int patternEnum) {
 
 }
 
-void _LPP_processParameterUpdate(LightProtocolParameter param, int start) {
+// decode a parameter in place from the receive frame
+//   and store it to each of its channels
+void _LPP_processParameterUpdate(LightProtocolParameter param, uint8_t start) {
 
-    // temp storage variables to reduce calculations
-    // in each case statement
-    uint16_t received_uint;
-    uint16_t received_uint_radians;
-    
-    switch(param) {
+    LightParamDescriptor descriptor;
+    memcpy_P(&descriptor, &_LPP_descriptors[param], sizeof(descriptor));
 
-        case PARAM_BIAS_RED: 
-            LPP_pattern_protocol.redPattern->bias = TWI_Buffer[start];
-            break;
+    uint16_t value = 0;
+    if (descriptor.size == 1)
+        value = TWI_frameByte(start);
+    else if (descriptor.size == 2)
+        value = UTIL_charToInt(TWI_frameByte(start), TWI_frameByte(start+1));
 
-        case PARAM_BIAS_GREEN: 
-            LPP_pattern_protocol.greenPattern->bias = TWI_Buffer[start];
-            break;
+    if (descriptor.convert && !descriptor.convert(&value)) return;
 
-        case PARAM_BIAS_BLUE: 
-            LPP_pattern_protocol.bluePattern->bias = TWI_Buffer[start];
-            break;
+    if (descriptor.width && descriptor.field == offsetof(PatternGenerator, cyclesRemaining))
+        _LPP_stagedFields |= LPP_STAGED_CYCLES;
 
-        case PARAM_AMPLITUDE_RED: 
-            LPP_pattern_protocol.redPattern->amplitude = TWI_Buffer[start];
-            break;
+    PatternGenerator* patterns[] = {
+        LPP_pattern_protocol.redPattern,
+        LPP_pattern_protocol.greenPattern,
+        LPP_pattern_protocol.bluePattern
+    };
 
-        case PARAM_AMPLITUDE_GREEN: 
-            LPP_pattern_protocol.greenPattern->amplitude = TWI_Buffer[start];
-            break;
+    uint8_t i;
+    for (i = 0; i < 3; i++) {
+        if (!(descriptor.channels & (1 << i))) continue;
 
-        case PARAM_AMPLITUDE_BLUE: 
-            LPP_pattern_protocol.bluePattern->amplitude = TWI_Buffer[start];
-            break;
+        uint8_t* field = (uint8_t*)patterns[i] + descriptor.field;
+        if (descriptor.width == 2)
+            *(uint16_t*)field = value;
+        else
+            *field = value;
+    }
 
-        case PARAM_PERIOD: 
-            received_uint = UTIL_charToInt(TWI_Buffer[start], TWI_Buffer[start+1]);
-            LPP_pattern_protocol.redPattern->speed    = MAX_PATTERN_PERIOD / received_uint;
-            LPP_pattern_protocol.greenPattern->speed  = MAX_PATTERN_PERIOD / received_uint;
-            LPP_pattern_protocol.bluePattern->speed   = MAX_PATTERN_PERIOD / received_uint;
-            break;
+}
 
-        case PARAM_REPEAT: 
-            LPP_pattern_protocol.redPattern->cyclesRemaining    = TWI_Buffer[start];
-            LPP_pattern_protocol.greenPattern->cyclesRemaining  = TWI_Buffer[start];
-            LPP_pattern_protocol.bluePattern->cyclesRemaining   = TWI_Buffer[start];
-            break;
+// PARAM_PERIOD, pattern period in ms to speed
+uint8_t _LPP_toSpeed(uint16_t* value) {
 
-        case PARAM_PHASEOFFSET: 
-            received_uint_radians = UTIL_degToRad(UTIL_charToInt(TWI_Buffer[start], TWI_Buffer[start+1]));
-            LPP_pattern_protocol.redPattern->phase    = received_uint_radians;
-            LPP_pattern_protocol.greenPattern->phase  = received_uint_radians;
-            LPP_pattern_protocol.bluePattern->phase   = received_uint_radians;
-            break;
+    // a zero period has no speed
+    if (*value == 0) return 0;
 
-        case PARAM_MACRO:
-            if (TWI_Buffer[start] < PARAM_MACRO_ENUM_COUNT)
-                LPP_setParamMacro(TWI_Buffer[start]);
-            break;
+    *value = MAX_PATTERN_PERIOD / *value;
+    return 1;
 
-        case PARAM_RESET:
-            if(TWI_Buffer[start] == RESET_NONCE)
-                // Soft-reset by enabling the watchdog and going into a tight loop
-                wdt_enable(WDTO_15MS);
-                for(;;) {};
-            break;
-		
-		case PARAM_APP_CHECKSUM:
-			TWI_ReplyBuf[0] = (TWAR>>1);
-			TWI_ReplyBuf[1] = PARAM_APP_CHECKSUM;
-			TWI_ReplyBuf[2] = eeprom_read_byte((uint8_t*)EEPROM_APP_CRC_START + 1);
-			TWI_ReplyBuf[3] = eeprom_read_byte((uint8_t*)EEPROM_APP_CRC_START);
-			TWI_ReplyBuf[4] = TWI_calculatedXOR;
-			TWI_ReplyLen = 5;
-			break;
+}
 
-        default:
-            break;
+// PARAM_PHASEOFFSET, degrees to a binary angle
+uint8_t _LPP_toAngle(uint16_t* value) {
+
+    *value = UTIL_degToAngle(*value);
+    return 1;
+
+}
+
+uint8_t _LPP_runMacro(uint16_t* value) {
+
+    if (*value < PARAM_MACRO_ENUM_COUNT)
+        LPP_setParamMacro(*value);
+
+    return 0;
+
+}
+
+uint8_t _LPP_runReset(uint16_t* value) {
+
+    if (*value == RESET_NONCE) {
+        // Soft-reset by enabling the watchdog and going into a tight loop
+        wdt_enable(WDTO_15MS);
+        for(;;) {};
+    }
+
+    return 0;
+
+}
+
+uint8_t _LPP_replyChecksum(uint16_t* value) {
+
+    TWI_ReplyBuf[0] = (TWAR>>1);
+    TWI_ReplyBuf[1] = PARAM_APP_CHECKSUM;
+    TWI_ReplyBuf[2] = eeprom_read_byte((uint8_t*)EEPROM_APP_CRC_START + 1);
+    TWI_ReplyBuf[3] = eeprom_read_byte((uint8_t*)EEPROM_APP_CRC_START);
+    TWI_ReplyBuf[4] = TWI_frameXOR();
+    TWI_ReplyLen = 5;
+
+    return 0;
+
+}
+
+// PARAM_APPLY_ON_SYNC, hold the frame until the next sync pulse
+uint8_t _LPP_deferToSync(uint16_t* value) {
+
+    _LPP_isApplyOnSync = 1;
+    return 0;
+
+}
+
+uint8_t _LPP_setGamma(uint16_t* value) {
+
+    uint8_t channels = *value >> GAMMA_CHANNEL_SHIFT;
+    WG_setGammaCurve(channels ? channels : GAMMA_CHANNEL_ALL, 
+        *value & GAMMA_CURVE_MASK);
+
+    return 0;
+
+}
+
+// reply with the synchro clock statistics, 16-bit
+//  values are sent msb first. The statistics restart after
+//  each reply
+uint8_t _LPP_replySyncStats(uint16_t* value) {
+
+    SyncStats stats;
+    SYNCLK_getSyncStats(&stats);
+    SYNCLK_resetSyncStats();
+
+    uint16_t values[] = {
+        stats.phaseErrorMin, stats.phaseErrorMax, stats.phaseErrorMean,
+        stats.intervalMin, stats.intervalMax, stats.intervalMean,
+        stats.correctionAdded, stats.correctionRemoved, stats.frequencyTrim
+    };
+
+    TWI_ReplyBuf[0] = (TWAR>>1);
+    TWI_ReplyBuf[1] = PARAM_SYNC_STATS;
+    TWI_ReplyBuf[2] = stats.count;
+    TWI_ReplyBuf[3] = stats.stepCount;
+
+    uint8_t i;
+    for (i = 0; i < sizeof(values) / sizeof(*values); i++) {
+        TWI_ReplyBuf[4 + 2*i] = values[i] >> 8;
+        TWI_ReplyBuf[5 + 2*i] = values[i] & 0xFF;
     }
 
+    TWI_ReplyBuf[22] = TWI_frameXOR();
+    TWI_ReplyLen = 23;
+
+    return 0;
+
+}
+
+// reply with the number of pattern evaluations skipped since
+//  startup (see _PG_advance), msb first. The count wraps, so
+//  read it twice and take the difference
+uint8_t _LPP_replySkipCount(uint16_t* value) {
+
+    uint16_t count = PG_getSkipCount();
+
+    TWI_ReplyBuf[0] = (TWAR>>1);
+    TWI_ReplyBuf[1] = PARAM_SKIP_COUNT;
+    TWI_ReplyBuf[2] = count >> 8;
+    TWI_ReplyBuf[3] = count & 0xFF;
+    TWI_ReplyBuf[4] = TWI_frameXOR();
+    TWI_ReplyLen = 5;
+
+    return 0;
+
+}
+
+// flag all pattern generators for evaluation
+void _LPP_markDirty(void) {
+
+    PG_markDirty(LPP_pattern_protocol.redPattern);
+    PG_markDirty(LPP_pattern_protocol.greenPattern);
+    PG_markDirty(LPP_pattern_protocol.bluePattern);
+
 }
 
 // Pre-canned patterns and setting combinations
 // tuned through testing on lighting hardware
 void LPP_setParamMacro(LightParamMacro macro) {
     
+    // every macro updates generator parameters and sets the
+    //   cycles, the reset also clears the value
+    _LPP_markDirty();
+    _LPP_stagedFields |= LPP_STAGED_CYCLES;
+    if (macro == PARAM_MACRO_RESET) _LPP_stagedFields |= LPP_STAGED_VALUE;
+
     switch(macro) {
 		case PARAM_MACRO_RESET:
 			PG_init(LPP_pattern_protocol.redPattern);
@@ -210,9 +422,9 @@ void LPP_setParamMacro(LightParamMacro macro) {
             LPP_pattern_protocol.greenPattern->speed			= 1;
             LPP_pattern_protocol.bluePattern->speed				= 1;
 
-            LPP_pattern_protocol.redPattern->phase				= UTIL_degToRad(270 + NODE_station*30);
-            LPP_pattern_protocol.greenPattern->phase			= UTIL_degToRad(90  + NODE_station*30);
-            LPP_pattern_protocol.bluePattern->phase				= UTIL_degToRad(180 + NODE_station*30);
+            LPP_pattern_protocol.redPattern->phase				= UTIL_degToAngle(270 + NODE_station*30);
+            LPP_pattern_protocol.greenPattern->phase			= UTIL_degToAngle(90  + NODE_station*30);
+            LPP_pattern_protocol.bluePattern->phase				= UTIL_degToAngle(180 + NODE_station*30);
 
             LPP_pattern_protocol.redPattern->amplitude			= 120;
             LPP_pattern_protocol.redPattern->bias				= 120;
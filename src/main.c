@@ -31,14 +31,13 @@
 #include <util/delay.h>
 #include <avr/wdt.h>
 
-#include "math.h"
-
 #include "pattern_generator.h"
 #include "light_pattern_protocol.h"
 #include "synchro_clock.h"
 #include "twi_manager.h"
 #include "waveform_generator.h"
 #include "node_manager.h"
+#include "scheduler.h"
 
 //#define DEBUG_MACRO		PARAM_MACRO_AUTOMOBILE_COLORS
 
@@ -60,6 +59,9 @@ void get_mcusr(void)
 
 // main program entry point
 int main(void) {
+    // init mainloop event scheduler
+    SCHED_init();
+
     // init synchro node singleton
     SYNCLK_init();
 
@@ -92,6 +94,13 @@ int main(void) {
     //  updates in a coordinated way
     WG_onOverflow(SYNCLK_updateClock);
 
+#ifdef SYNCLK_STRESS_TEST
+    // read the clock against the running timer1 ISR forever,
+    //  see tools/simavr_stress.c
+    sei();
+    SYNCLK_stressTest();
+#endif
+
 #ifndef DEBUG_MACRO
     // configure startup health check timer
     //   to enter 'failed' more (all red LEDs)
@@ -106,36 +115,65 @@ int main(void) {
     // enable interrupts 
     sei();
 	
-	double clockPosition;
+	uint16_t clockPosition;
+
+    // channels evaluated together by the pattern generator
+    PatternGenerator* patterns[3] = {&pgRed, &pgGreen, &pgBlue};
 
 #ifdef DEBUG_MACRO
 	LPP_setParamMacro(DEBUG_MACRO);
 #endif
 	
     // application mainloop 
+    //   sleeps until an interrupt posts an event, then handles
+    //   every event posted since the previous pass
     while(1) {
-        // run light effect calculations based
-        //   on synchronized clock reference
-        clockPosition = SYNCLK_getClockPosition();
-        PG_calc(&pgRed, clockPosition);
-        PG_calc(&pgGreen, clockPosition);
-        PG_calc(&pgBlue, clockPosition);
+        uint8_t events = SCHED_wait();
+
+        // startup has failed (see WDT_vect)
+        if (events & SCHED_EVENT_STARTUP_FAIL) {
+            // startup has failed, show all red LEDs
+            //   and stop processing further communication
+            LPP_discardStaged();
+            LPP_setParamMacro(PARAM_MACRO_RESET);
+            //NODE_system_status = NODE_STARTUP_FAIL;
+
+            // startup has failed, show all Aviation colors 
+            //   and continue to check for communications
+            LPP_setParamMacro(PARAM_MACRO_AUTOMOBILE_COLORS);
+        }
 		
 		// parse commands per interface contract
 		//  and update pattern generators accordingly
 		//  set startup condition success if a command rcvd
-		if (LPP_processBuffer() &&
-			NODE_system_status != NODE_STARTUP_SUCCESS) {
-			NODE_system_status = NODE_STARTUP_COMMRCVD;
+		if (events & SCHED_EVENT_COMMAND) {
+			if (LPP_processBuffer() &&
+				NODE_system_status != NODE_STARTUP_SUCCESS) {
+				NODE_system_status = NODE_STARTUP_COMMRCVD;
+			}
 		}
-		
-        // update LED PWM duty cycle
-        //   with values computed in pattern generator
-        WG_updatePWM();
 
-        // calculate time adjustment needed to 
-        //  sync up with system clock signal
-        SYNCLK_calcPhaseCorrection();
+		// scene changes staged for the sync pulse land
+		//  before the next frame is computed
+		if (events & SCHED_EVENT_SYNC) {
+			LPP_onSync();
+		}
+		
+        // compute one frame per clock tick
+        if (events & SCHED_EVENT_CLOCK_TICK) {
+            // run light effect calculations based
+            //   on synchronized clock reference
+            clockPosition = SYNCLK_getClockPosition();
+            PG_calcGroup(patterns, 3, clockPosition);
+
+            // update LED PWM duty cycle
+            //   with values computed in pattern generator
+            WG_updatePWM();
+
+            // calculate time adjustment needed to 
+            //  sync up with system clock signal
+            SYNCLK_calcPhaseCorrection();
+        }
 
         // reset WDT timer only if node startup status has already 
         //   been determined (if startup status is already determined, 
@@ -162,14 +200,9 @@ ISR(WDT_vect) {
             //   after startup - enter NODE_STARTUP_FAIL state
             if (NODE_startup_timeout_seconds == NODE_MAX_TIMEOUT_SECONDS) {
 
-                // startup has failed, show all red LEDs
-                //   and stop processing further communication
-                LPP_setParamMacro(PARAM_MACRO_RESET);
-                //NODE_system_status = NODE_STARTUP_FAIL;
-
-                // startup has failed, show all Aviation colors 
-                //   and continue to check for communications
-                LPP_setParamMacro(PARAM_MACRO_AUTOMOBILE_COLORS);
+                // startup has failed, the mainloop resets the 
+                //   pattern generators, which it owns
+                SCHED_post(SCHED_EVENT_STARTUP_FAIL);
             }
 
             // reset wdt flag
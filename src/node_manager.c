@@ -13,12 +13,7 @@
 #include "node_manager.h"
 #include "pattern_generator.h"
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/sleep.h>
-#include <avr/cpufunc.h>
-#include <util/delay.h>
-#include <avr/eeprom.h>
+#include "hal.h"
 
 uint8_t NODE_station;
 
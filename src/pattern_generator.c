@@ -11,12 +11,22 @@
 
 **********************************************************************/
 
-#include <avr/io.h>
+#include "hal.h"
 #include "pattern_generator.h"
+#include "carrier.h"
 #include "utilities.h"
-#include "math.h"
 
-double theta_at_speed;
+// sin(tan(theta) * 0.5) needs tan() as a binary angle:
+//   0.5 * 0x10000 / (2 * pi)
+#define _PG_SIREN_ANGLE_SCALE   5215
+
+// strobe window thresholds, Q14 (0.6 < sin(theta) < 0.8)
+#define _PG_AVIATION_STROBE_LOW    9831
+#define _PG_AVIATION_STROBE_HIGH   13107
+
+// number of evaluations skipped because the output could
+//  not change, wraps at 0xFFFF
+static uint16_t _PG_skipCount;
 
 void PG_init(PatternGenerator* self) {
     
@@ -29,89 +39,198 @@ void PG_init(PatternGenerator* self) {
     self->amplitude           = 1;
     self->bias                = 0;
     self->value               = 0;
+    self->isDirty             = 1;
+
+}
+
+// flag a generator for evaluation, must be called after
+//  any of its parameters are changed
+void PG_markDirty(PatternGenerator* self) {
+
+    self->isDirty = 1;
 
 }
 
-void PG_calc(PatternGenerator* self, double clock_position) { 
+// evaluations skipped since startup, see PARAM_SKIP_COUNT
+uint16_t PG_getSkipCount(void) {
+
+    return _PG_skipCount;
 
-    // update pattern instance theta
-	{
-		// calculate theta, in radians, from the current timer
-		double theta_at_speed = clock_position * self->speed;
+}
 
-		// calculate the speed and phase adjusted theta
-		double new_theta = fmod(theta_at_speed + self->phase, _TWO_PI);
+void PG_calc(PatternGenerator* self, uint16_t clock_position) {
 
-		// set pattern theta
-		self->theta = new_theta;
+    // calculate the speed and phase adjusted theta, the
+    //   binary angle wraps at 2*pi on its own
+    uint16_t new_theta = clock_position * self->speed + self->phase;
 
-		// set zero crossing flag
-		self->isNewCycle = (self->theta > new_theta) ? 1 : 0;
-	}
+    if (!_PG_advance(self, new_theta)) return;
+
+    _PG_apply(self, _PG_carrier(self));
+
+}
+
+// evaluate a group of generators, channels with the same time 
+//  domain share one theta and carrier calculation and only apply
+//  their own bias and amplitude. if any channel differs, the group
+//  falls back to evaluating each channel on its own
+void PG_calcGroup(PatternGenerator** group, uint8_t count, uint16_t clock_position) {
+
+    PatternGenerator* first = group[0];
+    uint8_t i;
+
+    for (i = 1; i < count; i++) {
+        if (!_PG_isSameTimeDomain(first, group[i])) {
+            for (i = 0; i < count; i++) PG_calc(group[i], clock_position);
+            return;
+        }
+    }
+
+    // calculate the speed and phase adjusted theta once
+    uint16_t new_theta = clock_position * first->speed + first->phase;
+
+    // the carrier is only calculated if a channel needs it
+    uint8_t isCarrierValid = 0;
+    int16_t carrier = 0;
+
+    for (i = 0; i < count; i++) {
+        if (!_PG_advance(group[i], new_theta)) continue;
+
+        if (!isCarrierValid) {
+            carrier = _PG_carrier(group[i]);
+            isCarrierValid = 1;
+        }
+        _PG_apply(group[i], carrier);
+    }
+
+}
+
+// true if two generators will have the same theta, cycle count 
+//  and carrier after the next evaluation
+uint8_t _PG_isSameTimeDomain(PatternGenerator* a, PatternGenerator* b) {
+
+    return a->pattern == b->pattern &&
+        a->speed == b->speed &&
+        a->phase == b->phase &&
+        a->theta == b->theta &&
+        a->cyclesRemaining == b->cyclesRemaining;
+
+}
+
+// move the generator to a new theta and count the cycles, returns
+//  false if the evaluation can be skipped since the output can not 
+//  change. theta is kept current so zero crossings are still detected
+uint8_t _PG_advance(PatternGenerator* self, uint16_t new_theta) {
+
+    // set zero crossing flag
+    self->isNewCycle = (self->theta > new_theta) ? 1 : 0;
+
+    // set pattern theta
+    self->theta = new_theta;
+
+    // the steady check comes first, the tick on which the last
+    //   cycle ends must still be evaluated
+    if (!self->isDirty && _PG_isSteady(self)) {
+        _PG_skipCount++;
+        return 0;
+    }
+    self->isDirty = 0;
 
     // decrement the cycles remaining until
     // equals CYCLES_STOP
     if (self->isNewCycle && self->cyclesRemaining >= 0)
         self->cyclesRemaining--;
 
-    // update pattern value
+    return 1;
+
+}
+
+// Q14 carrier signal of the pattern at the current theta, zero
+//  for patterns which do not use one at this point of their cycle
+int16_t _PG_carrier(PatternGenerator* self) {
+
+    if (self->cyclesRemaining == CYCLES_STOP) return 0;
+
     switch(self->pattern) {
 
 		case PATTERN_FWUPDATE:
-			if (self->cyclesRemaining != CYCLES_STOP) {
-				// calculate the carrier signal
-				double carrier = sin(self->theta);
+        case PATTERN_STROBE: 
+		case PATTERN_AVIATION_STROBE:
+			return CARRIER_sin(self->theta);
+
+        case PATTERN_BREATHE: {
+            int16_t carrier = CARRIER_cos(self->theta);
+            return (carrier < 0) ? -carrier : carrier;
+        }
+
+        case PATTERN_SIREN: {
+			// sin(tan(theta)*.5), tan() is taken as sin/cos, 
+			//   scaled directly to a binary angle
+			int16_t cosine = CARRIER_cos(self->theta);
+			if (cosine == 0) cosine = 1;
+			uint16_t siren_theta = ((int32_t)CARRIER_sin(self->theta) * _PG_SIREN_ANGLE_SCALE) / cosine;
+			return CARRIER_sin(siren_theta);
+        }
+
+        // fades run over a quarter wave in their last cycle
+        case PATTERN_FADEOUT: 
+			return (self->cyclesRemaining == 0) ? CARRIER_cos(self->theta >> 2) : 0;
+
+        case PATTERN_FADEIN: 
+			return (self->cyclesRemaining == 0) ? CARRIER_sin(self->theta >> 2) : 0;
+
+        default:
+            return 0;
+
+    }
 
+}
+
+// update the pattern value from the carrier signal
+void _PG_apply(PatternGenerator* self, int16_t carrier) {
+
+    switch(self->pattern) {
+
+		case PATTERN_FWUPDATE:
+			if (self->cyclesRemaining != CYCLES_STOP) {
 				// value is a sin function output of the form
 				// B + A * sin(theta)
-				self->value = self->bias + self->amplitude * carrier;
+				self->value = _PG_saturate(((int32_t)self->bias << 14) +
+					(int32_t)self->amplitude * carrier);
 			}
 			break;
 
         case PATTERN_BREATHE: 
             if (self->cyclesRemaining != CYCLES_STOP) {
-	            // calculate the carrier signal
-	            double carrier = fabs(cos(self->theta));
-
 	            // value is a sin function output of the form
 	            // B * (A * abs(cos(theta)))
-				self->value = self->bias * (self->amplitude * carrier);
+				self->value = _PG_saturate((int32_t)self->bias * self->amplitude * carrier);
             }
             break;
 
         case PATTERN_STROBE: 
             if (self->cyclesRemaining != CYCLES_STOP) {
-	            // calculate the carrier signal
-	            // as square wave
-	            float carrier = (sin(self->theta) > 0) ? 1 : 0;
-
 	            // value is a square wave with an
 	            // adjustable amplitude and bias
-	            //self->value = self->bias + self->amplitude * carrier;
-				self->value = self->bias * carrier;
+				self->value = (carrier > 0) ? self->bias : 0;
             }
             break;
 		
 		case PATTERN_AVIATION_STROBE:
 			if (self->cyclesRemaining != CYCLES_STOP) {
-				// calculate the carrier signal
-				// as two square waves per cycle
+				// two square waves per cycle
 				// a pattern speed of 5 is close to realistic
-				float carrier = (sin(self->theta) > 0.6 && sin(self->theta) < 0.8) ? 1 : 0;
-
 				// value is a square wave with an adjustable bias
-				self->value = self->bias * carrier;
+				self->value = (carrier >= _PG_AVIATION_STROBE_LOW &&
+					carrier <= _PG_AVIATION_STROBE_HIGH) ? self->bias : 0;
 			}
 			break;
 
         case PATTERN_SIREN:
 			if (self->cyclesRemaining != CYCLES_STOP) {
-				// calculate the carrier signal
-				float carrier = sin(tan(self->theta)*.5);
-
 				// value is an annoying strobe-like pattern
 				// B * (A * abs(cos(theta)))
-				self->value = self->bias * (self->amplitude * carrier);
+				self->value = _PG_saturate((int32_t)self->bias * self->amplitude * carrier);
 			}
             break;
 
@@ -122,11 +241,8 @@ void PG_calc(PatternGenerator* self, double clock_position) {
         case PATTERN_FADEOUT: 
 			if (self->cyclesRemaining > 0) return;
 			if (self->cyclesRemaining == 0) {
-				// calculate the carrier signal
-				double carrier = cos(self->theta/4);
-
 				// update output
-				self->value = self->amplitude * carrier;
+				self->value = _PG_saturate((int32_t)self->amplitude * carrier);
 			} else {
 				self->value = 0;
 			} 
@@ -135,11 +251,8 @@ void PG_calc(PatternGenerator* self, double clock_position) {
         case PATTERN_FADEIN: 
 			if (self->cyclesRemaining > 0) return;
 			if (self->cyclesRemaining == 0) {
-				// calculate the carrier signal
-				double carrier = sin(self->theta/4);
-
 				// update output
-				self->value = self->bias * carrier;
+				self->value = _PG_saturate((int32_t)self->bias * carrier);
 			} else {
 				self->value = self->bias;
 			}
@@ -155,3 +268,36 @@ void PG_calc(PatternGenerator* self, double clock_position) {
     }
 
 }
+
+// true if the output of the generator is constant until one
+//  of its parameters is changed; either the pattern does not
+//  depend on theta and no cycles are being counted, or the
+//  pattern has stopped
+uint8_t _PG_isSteady(PatternGenerator* self) {
+
+    if (self->cyclesRemaining == CYCLES_STOP) return 1;
+    if (self->cyclesRemaining >= 0) return 0;
+
+    switch(self->pattern) {
+        case PATTERN_OFF:
+        case PATTERN_SOLID:
+        case PATTERN_FADEIN:
+        case PATTERN_FADEOUT:
+        case PATTERN_PING:
+            return 1;
+
+        default:
+            return 0;
+    }
+
+}
+
+// clamp a Q14 pattern output to the 8-bit output range,
+//   the fractional part is truncated
+uint8_t _PG_saturate(int32_t value) {
+
+    if (value < 0) return 0;
+    value >>= 14;
+    return (value > 0xFF) ? 0xFF : value;
+
+}
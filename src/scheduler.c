@@ -0,0 +1,74 @@
+/**********************************************************************
+
+  scheduler.c - implementation, see header for description
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include "hal.h"
+#include "scheduler.h"
+
+// private module singleton instance
+static Scheduler _self_scheduler;
+
+void SCHED_init(void) {
+
+    _self_scheduler.pendingEvents = 0;
+
+    // idle mode stops only the cpu clock, timers and
+    //  TWI keep running and wake the cpu up
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+}
+
+// post an event for the mainloop
+// NOTE: call from an ISR, or with interrupts disabled
+void SCHED_post(uint8_t event) {
+
+    _self_scheduler.pendingEvents |= event;
+
+}
+
+// take all pending events, without waiting
+uint8_t SCHED_take(void) {
+
+    cli();
+    uint8_t events = _self_scheduler.pendingEvents;
+    _self_scheduler.pendingEvents = 0;
+    sei();
+
+    return events;
+
+}
+
+// sleep until at least one event is pending, then take
+//  all pending events
+uint8_t SCHED_wait(void) {
+
+    // check for events with interrupts disabled, so that an event
+    //  posted between the check and sleep_cpu() can not be missed. 
+    //  sei takes effect after the next instruction, so sleep is 
+    //  entered before any pending interrupt is serviced, and that 
+    //  interrupt then wakes the cpu
+    cli();
+    while (!_self_scheduler.pendingEvents) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+
+    uint8_t events = _self_scheduler.pendingEvents;
+    _self_scheduler.pendingEvents = 0;
+    sei();
+
+    return events;
+
+}
@@ -11,9 +11,9 @@
 
 **********************************************************************/
 
-#include <avr/io.h>
-#include "math.h"
+#include "hal.h"
 #include "synchro_clock.h"
+#include "scheduler.h"
 
 #include "utilities.h"
 
@@ -22,29 +22,86 @@ static SyncroClock _self_synchro_clock;
 
 void SYNCLK_init(void) {
     // init instance members
-    _self_synchro_clock.clockSkips                = 0;
     _self_synchro_clock.isPhaseCorrectionUpdated  = 1;
-    _self_synchro_clock.nodePhaseError            = 0;
+    _self_synchro_clock.isSyncIntervalValid       = 0;
+    _self_synchro_clock.stepCount                 = 0;
+    _self_synchro_clock.phaseSignalsTaken         = 0;
+    _self_synchro_clock.clockSequence             = 0;
+    _self_synchro_clock.phaseSignalCount          = 0;
+    _self_synchro_clock.tickStepIndex             = 0;
+    _self_synchro_clock.isClockShiftPending       = 0;
+    _self_synchro_clock.kp                        = SYNCLK_KP_DEFAULT;
+    _self_synchro_clock.ki                        = SYNCLK_KI_DEFAULT;
+    _self_synchro_clock.ticksSinceSync            = 0;
+    _self_synchro_clock.capturedTicks             = 0;
+    _self_synchro_clock.capturedTime              = 0;
+    _self_synchro_clock.syncInterval              = 0;
+    _self_synchro_clock.phaseCorrection           = 0;
+    _self_synchro_clock.frequencyTrim             = 0;
+    _self_synchro_clock.correctionApplied         = 0;
+    _self_synchro_clock.clockShift                = 0;
+    _self_synchro_clock.tickStep[0]               = _SYNCLK_TICK_INCREMENT_Q16;
+    _self_synchro_clock.tickStep[1]               = _SYNCLK_TICK_INCREMENT_Q16;
     _self_synchro_clock.nodeTimeOffset            = 0;
     _self_synchro_clock.nodeTime                  = 0;
+    SYNCLK_resetSyncStats();
 }
 
-// return clock position, in radians
-double SYNCLK_getClockPosition(void) {
+// set the phase correction loop gains, Q8 (256 == 1.0)
+//  kp: fraction of the phase error slewed out after each phase signal
+//  ki: fraction of the estimated frequency error trimmed after each 
+//      phase signal, must be below 512 for the loop to be stable
+void SYNCLK_setGains(uint16_t kp, uint16_t ki) {
 
-    return (_self_synchro_clock.nodeTime / _SYNCLK_CLOCK_TOP) * _TWO_PI;
+    _self_synchro_clock.kp = kp;
+    _self_synchro_clock.ki = ki;
+
+}
+
+// return clock position, as a 16-bit binary angle
+uint16_t SYNCLK_getClockPosition(void) {
+
+    uint8_t sequence;
+    uint32_t nodeTime;
+
+    // snapshot, repeated if the timer1 ISR updated the clock
+    do {
+        sequence = _self_synchro_clock.clockSequence;
+        nodeTime = _self_synchro_clock.nodeTime;
+    } while (sequence != _self_synchro_clock.clockSequence);
+
+    return nodeTime >> 16;
 
 }
 
 // advance internal clock
 void SYNCLK_updateClock(void) {
 
-    // mark time in light manager
-    _SYNCLK_clockTick();
+    // mark time in light manager, the step includes the
+    //  frequency trim and any phase slew. the clock wraps at TOP
+    //  with the 32-bit add
+    uint32_t nodeTime = _self_synchro_clock.nodeTime + 
+        _self_synchro_clock.tickStep[_self_synchro_clock.tickStepIndex];
+
+    // apply a clock step requested by the mainloop
+    if (_self_synchro_clock.isClockShiftPending) {
+        nodeTime = _SYNCLK_shiftClock(nodeTime, _self_synchro_clock.clockShift);
+        _self_synchro_clock.isClockShiftPending = 0;
+    }
+
+    _self_synchro_clock.nodeTime = nodeTime;
+    _self_synchro_clock.clockSequence++;
+
+    // count ticks between phase signals
+    if (_self_synchro_clock.ticksSinceSync < 0xFFFF)
+        _self_synchro_clock.ticksSinceSync++;
 
     // phase correction can be updated
     _SYNCLK_setPhaseCorrectionStale();
 
+    // run the mainloop for this tick
+    SCHED_post(SCHED_EVENT_CLOCK_TICK);
+
 }
 
 // calculate correction for phase error
@@ -55,81 +112,215 @@ void SYNCLK_calcPhaseCorrection(void) {
     // phase correction already updated in this cycle
     if (_self_synchro_clock.isPhaseCorrectionUpdated) return;
 
-    // calculate phase error if a phase signal received
-    if (_self_synchro_clock.nodeTimeOffset != 0) {
+    // snapshot the last phase signal recorded by the TWI ISR
+    uint8_t sequence;
+    uint8_t phaseSignalCount;
+    uint32_t nodeTimeOffset;
+    uint16_t syncInterval;
+    do {
+        sequence = _self_synchro_clock.clockSequence;
+        phaseSignalCount = _self_synchro_clock.phaseSignalCount;
+        nodeTimeOffset = _self_synchro_clock.nodeTimeOffset;
+        syncInterval = _self_synchro_clock.syncInterval;
+    } while (sequence != _self_synchro_clock.clockSequence);
+
+    // update the loop once per phase signal
+    if (phaseSignalCount != _self_synchro_clock.phaseSignalsTaken) {
+        _self_synchro_clock.phaseSignalsTaken = phaseSignalCount;
+        _SYNCLK_updateLoop(nodeTimeOffset, syncInterval);
+    }
 
-        // device is behind system time
-        // phase error is negative
-        if (_self_synchro_clock.nodeTimeOffset >= _SYNCLK_CLOCK_TOP/2) {
-            _self_synchro_clock.nodePhaseError = (_self_synchro_clock.nodeTimeOffset - _SYNCLK_CLOCK_TOP) / _SYNCLK_TICK_INCREMENT;
+    // slew out the proportional correction, limited so 
+    //  the clock never runs backwards or too fast
+    int32_t slew = _self_synchro_clock.phaseCorrection;
+    if (slew > (int32_t)_SYNCLK_SLEW_MAX_Q16) slew = _SYNCLK_SLEW_MAX_Q16;
+    if (slew < -(int32_t)_SYNCLK_SLEW_MAX_Q16) slew = -(int32_t)_SYNCLK_SLEW_MAX_Q16;
+    _self_synchro_clock.phaseCorrection -= slew;
+    _self_synchro_clock.correctionApplied += slew;
 
-        // device is ahead of system time
-        // phase error is positive
-        } else {
-            _self_synchro_clock.nodePhaseError = _self_synchro_clock.nodeTimeOffset / _SYNCLK_TICK_INCREMENT;
+    // hand the step to the ISR, writing the slot it is not using
+    uint8_t index = !_self_synchro_clock.tickStepIndex;
+    _self_synchro_clock.tickStep[index] = _SYNCLK_TICK_INCREMENT_Q16 + 
+        _self_synchro_clock.frequencyTrim + slew;
+    _self_synchro_clock.tickStepIndex = index;
+
+    // phase correction has been updated
+    _self_synchro_clock.isPhaseCorrectionUpdated = 1;
+
+}
+
+// run the PI loop on the clock time seen at a phase signal, 
+//  sync_interval is the number of ticks since the previous one
+void _SYNCLK_updateLoop(uint32_t node_time_offset, uint16_t sync_interval) {
+
+    // phase error, positive if the device is ahead of system
+    //   time and negative if it is behind: the clock time as signed,
+    //   since the clock wraps at 32 bits
+    int32_t phaseError = (int32_t)node_time_offset;
+
+    char isSyncIntervalValid = _self_synchro_clock.isSyncIntervalValid;
+    _self_synchro_clock.isSyncIntervalValid = 1;
+
+    // the first phase signal ends no interval
+    if (isSyncIntervalValid) _SYNCLK_recordStats(phaseError, sync_interval);
+
+    // far out of phase, step onto the phase signal on the next
+    //   tick. the error says nothing about the oscillator frequency
+    if (phaseError > (int32_t)_SYNCLK_STEP_THRESHOLD_Q16 || 
+        phaseError < -(int32_t)_SYNCLK_STEP_THRESHOLD_Q16) {
+        if (!_self_synchro_clock.isClockShiftPending) {
+            _self_synchro_clock.clockShift = -phaseError;
+            _self_synchro_clock.isClockShiftPending = 1;
+            _self_synchro_clock.correctionApplied -= phaseError;
+            _self_synchro_clock.stepCount++;
         }
+        _self_synchro_clock.phaseCorrection = 0;
+        return;
+    }
+
+    // proportional term, replaces any correction not yet slewed 
+    //   since that is included in the new error
+    _self_synchro_clock.phaseCorrection = -(phaseError >> 8) * _self_synchro_clock.kp;
 
-        // do not calculate phaseError again until another phase signal received
-        _self_synchro_clock.nodeTimeOffset = 0;
+    // integral term, the error left after the previous correction 
+    //   has built up from the frequency error over the interval
+    if (isSyncIntervalValid && sync_interval > 0) {
+        int32_t trim = _self_synchro_clock.frequencyTrim - 
+            ((phaseError / sync_interval) * _self_synchro_clock.ki >> 8);
 
+        if (trim > (int32_t)_SYNCLK_TRIM_MAX_Q16) trim = _SYNCLK_TRIM_MAX_Q16;
+        if (trim < -(int32_t)_SYNCLK_TRIM_MAX_Q16) trim = -(int32_t)_SYNCLK_TRIM_MAX_Q16;
+        _self_synchro_clock.frequencyTrim = trim;
     }
 
-    // only apply correction if magnitude is greater than threshold
-    // to minimize some chasing
-    if (fabs(_self_synchro_clock.nodePhaseError) >= _SYNCLK_CORRECTION_THRESHOLD) { 
-
-        // if phase error negative, add an extra clock tick
-        // if positive, remove a clock tick
-        if (_self_synchro_clock.nodePhaseError < 0) {
-            _SYNCLK_clockTick();
-            _self_synchro_clock.nodePhaseError++;
-        } else {
-            _SYNCLK_clockSkip();
-            _self_synchro_clock.nodePhaseError--;
-        }        
-        
+}
+
+// add a phase signal to the running statistics
+void _SYNCLK_recordStats(int32_t phase_error, uint16_t sync_interval) {
+
+    SyncStatsCounters* stats = &_self_synchro_clock.stats;
+    int16_t phaseError = _SYNCLK_toMicroseconds(phase_error);
+    int16_t correction = _SYNCLK_toMicroseconds(_self_synchro_clock.correctionApplied);
+    _self_synchro_clock.correctionApplied = 0;
+
+    if (stats->count == UINT16_MAX) return;
+    stats->count++;
+
+    if (phaseError < stats->phaseErrorMin) stats->phaseErrorMin = phaseError;
+    if (phaseError > stats->phaseErrorMax) stats->phaseErrorMax = phaseError;
+    stats->phaseErrorSum += phaseError;
+
+    if (sync_interval < stats->intervalMin) stats->intervalMin = sync_interval;
+    if (sync_interval > stats->intervalMax) stats->intervalMax = sync_interval;
+    stats->intervalSum += sync_interval;
+
+    if (correction > 0) {
+        uint16_t added = stats->correctionAdded + correction;
+        stats->correctionAdded = (added < stats->correctionAdded) ? UINT16_MAX : added;
+    } else {
+        uint16_t removed = stats->correctionRemoved - correction;
+        stats->correctionRemoved = (removed < stats->correctionRemoved) ? UINT16_MAX : removed;
     }
 
-    // phase correction has been updated
-    _self_synchro_clock.isPhaseCorrectionUpdated = 1;
+}
+
+// clear the running statistics, the next phase signal starts them
+void SYNCLK_resetSyncStats(void) {
+
+    SyncStatsCounters* stats = &_self_synchro_clock.stats;
+    stats->phaseErrorSum = 0;
+    stats->intervalSum = 0;
+    stats->count = 0;
+    stats->phaseErrorMin = INT16_MAX;
+    stats->phaseErrorMax = INT16_MIN;
+    stats->intervalMin = UINT16_MAX;
+    stats->intervalMax = 0;
+    stats->correctionAdded = 0;
+    stats->correctionRemoved = 0;
 
 }
 
-// increment clock and also apply
-//  adjustment if local phase is behind 
-//  system phase
-void _SYNCLK_clockTick(void) {
+// summarize the running statistics
+void SYNCLK_getSyncStats(SyncStats* stats) {
 
+    SyncStatsCounters* counters = &_self_synchro_clock.stats;
 
-    // adjust clock for phase error
-    if (_self_synchro_clock.clockSkips > 0) { 
-        _self_synchro_clock.clockSkips--;
-        return;
-    }
+    stats->count = (counters->count > UINT8_MAX) ? UINT8_MAX : counters->count;
+    stats->stepCount = _self_synchro_clock.stepCount;
 
-    // increment lighting pattern effect clock
-    if (_self_synchro_clock.nodeTime < _SYNCLK_CLOCK_TOP) {
-        _self_synchro_clock.nodeTime += _SYNCLK_TICK_INCREMENT;
+    if (counters->count) {
+        stats->phaseErrorMin = counters->phaseErrorMin;
+        stats->phaseErrorMax = counters->phaseErrorMax;
+        stats->phaseErrorMean = counters->phaseErrorSum / (int32_t)counters->count;
+        stats->intervalMin = counters->intervalMin;
+        stats->intervalMax = counters->intervalMax;
+        stats->intervalMean = counters->intervalSum / counters->count;
     } else {
-        _self_synchro_clock.nodeTime = _SYNCLK_CLOCK_RESET;
-    } 
+        stats->phaseErrorMin = stats->phaseErrorMax = stats->phaseErrorMean = 0;
+        stats->intervalMin = stats->intervalMax = stats->intervalMean = 0;
+    }
+
+    stats->correctionAdded = counters->correctionAdded;
+    stats->correctionRemoved = counters->correctionRemoved;
+
+    // ppm of the tick increment, 1000000 == 15625 << 6
+    int32_t trim = (_self_synchro_clock.frequencyTrim * 15625L) / 
+        (int32_t)((_SYNCLK_TICK_INCREMENT_Q16 + 32) >> 6);
+    if (trim > INT16_MAX) trim = INT16_MAX;
+    if (trim < INT16_MIN) trim = INT16_MIN;
+    stats->frequencyTrim = trim;
+
+}
+
+// convert a Q16 clock time to microseconds, saturated to 16 bits
+int16_t _SYNCLK_toMicroseconds(int32_t time) {
+
+    time /= (int32_t)_SYNCLK_Q16_PER_US;
+    if (time > INT16_MAX) return INT16_MAX;
+    if (time < INT16_MIN) return INT16_MIN;
+    return time;
 
 }
 
-// clock adjustment to be applied
-//  if local phase is ahead of system
-void _SYNCLK_clockSkip(void) {
+// move a clock time by a Q16 offset of less than a 
+//  period, wrapping at TOP
+uint32_t _SYNCLK_shiftClock(uint32_t node_time, int32_t offset) {
 
-    _self_synchro_clock.clockSkips++;
+    return node_time + offset;
 
 }
 
 // call on receipt of a phase correction
 //  signal to record the local offset from
 //  the system value
+// NOTE: call from an ISR
 void SYNCLK_recordPhaseError(void) {
 
-    _self_synchro_clock.nodeTimeOffset = _self_synchro_clock.nodeTime;
+    SYNCLK_capturePhaseSignal();
+    SYNCLK_commitPhaseSignal();
+
+}
+
+// call when a general call is addressed, before it is known
+//  whether it is a phase signal (no data) or a broadcast
+// NOTE: call from an ISR
+void SYNCLK_capturePhaseSignal(void) {
+
+    _self_synchro_clock.capturedTime = _self_synchro_clock.nodeTime;
+    _self_synchro_clock.capturedTicks = _self_synchro_clock.ticksSinceSync;
+
+}
+
+// call when the captured general call turns out to be a phase
+//  signal, records the local offset at the time of the capture
+// NOTE: call from an ISR
+void SYNCLK_commitPhaseSignal(void) {
+
+    _self_synchro_clock.nodeTimeOffset = _self_synchro_clock.capturedTime;
+    _self_synchro_clock.syncInterval = _self_synchro_clock.capturedTicks;
+    _self_synchro_clock.ticksSinceSync -= _self_synchro_clock.capturedTicks;
+    _self_synchro_clock.phaseSignalCount++;
+    _self_synchro_clock.clockSequence++;
 
 }
 
@@ -143,3 +334,49 @@ void _SYNCLK_setPhaseCorrectionStale(void) {
 
 }
 
+#ifdef HOST_BUILD
+// exchange the module singleton with another clock state, lets 
+//  a host simulation run several nodes on one instance
+void SYNCLK_swapState(SyncroClock* other) {
+
+    SyncroClock state = _self_synchro_clock;
+    _self_synchro_clock = *other;
+    *other = state;
+
+}
+#endif
+
+#ifdef SYNCLK_STRESS_TEST
+// clock snapshot stress test, see tools/simavr_stress.c
+//  the mainloop reads the clock position continuously while the
+//  timer1 ISR advances it. a read is torn if the position is not 
+//  between the clock positions just before and just after it
+uint32_t SYNCLK_stressReads;
+uint32_t SYNCLK_stressInterrupted;
+uint32_t SYNCLK_stressTorn;
+
+void SYNCLK_stressTest(void) {
+
+    while (1) {
+        cli();
+        uint8_t sequence = _self_synchro_clock.clockSequence;
+        uint32_t before = _self_synchro_clock.nodeTime;
+        sei();
+
+        uint16_t position = SYNCLK_getClockPosition();
+
+        cli();
+        uint32_t after = _self_synchro_clock.nodeTime;
+        if (sequence != _self_synchro_clock.clockSequence) 
+            SYNCLK_stressInterrupted++;
+        sei();
+
+        uint16_t first = before >> 16;
+        uint16_t last = after >> 16;
+        if ((uint16_t)(position - first) > (uint16_t)(last - first))
+            SYNCLK_stressTorn++;
+        SYNCLK_stressReads++;
+    }
+
+}
+#endif
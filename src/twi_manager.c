@@ -11,25 +11,34 @@
 
 **********************************************************************/
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/cpufunc.h>
-#include <avr/sfr_defs.h>
-#include <util/delay.h>
+#include "hal.h"
 #include <string.h>
 
 #include "twi_manager.h"
 #include "node_manager.h"
 #include "synchro_clock.h"
 #include "light_pattern_protocol.h"
+#include "scheduler.h"
 
 extern uint8_t NODE_station;
 
 static uint8_t TWI_SendPtr;
 
+// frame being received, not visible to the
+//   mainloop until the queue head is advanced
+static uint8_t TWI_WritePtr;
+static uint8_t TWI_FrameLength;
+
+// broadcast record being received
+static uint8_t TWI_RecordState;
+static uint8_t TWI_RecordMask;
+static uint8_t TWI_RecordRemaining;
+
 // TWI application status flags
 static uint8_t TWI_isBufferAvailable; 
 static uint8_t TWI_isSlaveAddressed;
+static uint8_t TWI_isGeneralCall;
+static uint8_t TWI_isRecordForNode;
 
 void TWI_init(uint8_t deviceId) {
 
@@ -54,6 +63,94 @@ void TWI_init(uint8_t deviceId) {
 
 }
 
+// length of the oldest queued frame, 0 if the queue is empty
+uint8_t TWI_peekFrame(void) {
+
+    uint8_t tail = TWI_queue.tail;
+
+    if (tail == TWI_queue.head) return 0;
+
+    return TWI_queue.buffer[tail & TWI_QUEUE_MASK];
+
+}
+
+// command byte of the oldest queued frame
+uint8_t TWI_frameByte(uint8_t index) {
+
+    return TWI_queue.buffer[(uint8_t)(TWI_queue.tail + TWI_FRAME_HEADER + index) & TWI_QUEUE_MASK];
+
+}
+
+// XOR calculated by the ISR for the oldest queued frame
+uint8_t TWI_frameXOR(void) {
+
+    return TWI_queue.buffer[(uint8_t)(TWI_queue.tail + 1) & TWI_QUEUE_MASK];
+
+}
+
+// release the oldest queued frame back to the ISR
+void TWI_popFrame(void) {
+
+    uint8_t length = TWI_peekFrame();
+
+    if (length) TWI_queue.tail += TWI_FRAME_HEADER + length;
+
+}
+
+uint8_t TWI_getDropCount(void) {
+
+    return TWI_queue.framesDropped;
+
+}
+
+// general call data, the records for this station are written
+//   to the queue as frames but not published until the call
+//   ends with a valid XOR, so they are applied together
+// NOTE: call from an ISR
+void _TWI_receiveBroadcast(uint8_t data) {
+
+    switch (TWI_RecordState) {
+
+        case TWI_RECORD_START:
+        case TWI_RECORD_MASK:
+            TWI_RecordMask = data;
+            TWI_RecordState = TWI_RECORD_LENGTH;
+            break;
+
+        case TWI_RECORD_LENGTH:
+            TWI_RecordRemaining = data;
+            TWI_RecordState = data ? TWI_RECORD_DATA : TWI_RECORD_MASK;
+            TWI_isRecordForNode = data && TWI_isBufferAvailable &&
+                ((TWI_RecordMask >> NODE_station) & 1);
+
+            if (!TWI_isRecordForNode) break;
+
+            // reserve the frame, dropping the broadcast
+            //   if the record does not fit
+            if (data >= TWI_MAX_BUFFER_SIZE ||
+                (uint8_t)(TWI_WritePtr + TWI_FRAME_HEADER + data - TWI_queue.tail) > TWI_QUEUE_SIZE) {
+                TWI_isBufferAvailable = 0;
+                TWI_isRecordForNode = 0;
+                break;
+            }
+
+            // a broadcast has no reply, the frame XOR is unused
+            TWI_queue.buffer[TWI_WritePtr & TWI_QUEUE_MASK] = data;
+            TWI_queue.buffer[(uint8_t)(TWI_WritePtr + 1) & TWI_QUEUE_MASK] = 0;
+            TWI_WritePtr += TWI_FRAME_HEADER;
+            break;
+
+        case TWI_RECORD_DATA:
+            if (TWI_isRecordForNode)
+                TWI_queue.buffer[TWI_WritePtr++ & TWI_QUEUE_MASK] = data;
+
+            if (--TWI_RecordRemaining == 0)
+                TWI_RecordState = TWI_RECORD_MASK;
+            break;
+    }
+
+}
+
 // TWI ISR
 ISR(TWI_vect) {
 
@@ -90,11 +187,29 @@ ISR(TWI_vect) {
         //   Record the end of a transmission if stop bit received
         case TWI_SRX_STOP_RESTART:
             // execute callback when data received
-            // and addressed as slave (do not process gen call data)
+            // and addressed as slave, general calls are handled below
             if (TWI_isSlaveAddressed) {
-				TWI_transmittedXOR = TWI_Buffer[--TWI_Ptr]; // Pop the transmitted XOR from the buffer
+				TWI_isSlaveAddressed = 0;
+				TWI_ReplyLen = 0;
+
+				// an empty write carries no XOR and no command
+				if (TWI_FrameLength == 0) {
+					TWCR = TWCR_RESET;
+					break;
+				}
+
+				TWI_transmittedXOR = TWI_queue.buffer[--TWI_WritePtr & TWI_QUEUE_MASK]; // Pop the transmitted XOR from the buffer
+				TWI_FrameLength--;
 				TWI_calculatedXOR ^= TWI_transmittedXOR; // Double XOR the last byte to remove it from the checksum
 
+				// a frame which did not fit is dropped and not acknowledged,
+				//   so the master sees no reply and can resend it
+				if (!TWI_isBufferAvailable) {
+					if (TWI_queue.framesDropped < 0xFF) TWI_queue.framesDropped++;
+					TWCR = TWCR_RESET;
+					break;
+				}
+
 				if(TWI_transmittedXOR == TWI_calculatedXOR) {
 					// Send a reply containing the node address and the calculated XOR
 					TWI_ReplyBuf[0] = (TWAR>>1);
@@ -102,15 +217,40 @@ ISR(TWI_vect) {
 					
 					// Modify the response buffer if the received pattern was a ping
 					// This lets the master differentiate between a bootloader/application ping response
-					if(TWI_Buffer[0] == PATTERN_PING)
+					if(TWI_queue.buffer[(uint8_t)(TWI_queue.head + TWI_FRAME_HEADER) & TWI_QUEUE_MASK] == PATTERN_PING)
 						TWI_ReplyBuf[1]++;
 					
 					TWI_ReplyLen = 2;
-				} else {
-					TWI_ReplyLen = 0;
 				}
 				
-				LPP_pattern_protocol.isCommandFresh = 1;
+				// publish the frame, header first, then the head
+				if (TWI_FrameLength) {
+					TWI_queue.buffer[TWI_queue.head & TWI_QUEUE_MASK] = TWI_FrameLength;
+					TWI_queue.buffer[(uint8_t)(TWI_queue.head + 1) & TWI_QUEUE_MASK] = TWI_calculatedXOR;
+					TWI_queue.head = TWI_WritePtr;
+					SCHED_post(SCHED_EVENT_COMMAND);
+				}
+			}
+
+			// end of a general call
+			if (TWI_isGeneralCall) {
+				TWI_isGeneralCall = 0;
+
+				if (TWI_RecordState == TWI_RECORD_START) {
+					// no data, this was the sync pulse
+					SYNCLK_commitPhaseSignal();
+					SCHED_post(SCHED_EVENT_SYNC);
+
+				} else if (TWI_RecordState == TWI_RECORD_LENGTH && TWI_calculatedXOR == 0) {
+					// the last byte, taken as a record mask, was the
+					//   XOR of the data, so the XOR of all bytes is zero
+					if (!TWI_isBufferAvailable) {
+						if (TWI_queue.framesDropped < 0xFF) TWI_queue.framesDropped++;
+					} else if (TWI_WritePtr != TWI_queue.head) {
+						TWI_queue.head = TWI_WritePtr;
+						SCHED_post(SCHED_EVENT_COMMAND);
+					}
+				}
 			}
 
             // reset TWCR
@@ -121,10 +261,13 @@ ISR(TWI_vect) {
         //   every message with begin here
         case TWI_SRX_ADR_ACK:
 
-            // reset pointer
-            TWI_Ptr = 0;
+            // start a new frame after the last queued one,
+            //   leaving room for its header
+            TWI_WritePtr = TWI_queue.head + TWI_FRAME_HEADER;
+            TWI_FrameLength = 0;
             TWI_isBufferAvailable = 1;
             TWI_isSlaveAddressed = 1;
+            TWI_isGeneralCall = 0;
 			TWI_calculatedXOR = (TWAR>>1);
 
             // reset TWCR
@@ -135,14 +278,16 @@ ISR(TWI_vect) {
         //   data, continue capturing into buffer
         case TWI_SRX_ADR_DATA_ACK:
 
-            // record received data 
-            //   until buffer is full
-            if (TWI_Ptr == TWI_MAX_BUFFER_SIZE) 
+            // record received data until the frame or
+            //   the queue is full, dropping the frame
+            if (TWI_FrameLength == TWI_MAX_BUFFER_SIZE ||
+                (uint8_t)(TWI_WritePtr - TWI_queue.tail) >= TWI_QUEUE_SIZE)
                 TWI_isBufferAvailable = 0;
 
             if (TWI_isBufferAvailable) {
-                TWI_Buffer[TWI_Ptr++] = TWDR;
-				TWI_calculatedXOR ^= TWI_Buffer[TWI_Ptr-1];
+                TWI_queue.buffer[TWI_WritePtr++ & TWI_QUEUE_MASK] = TWDR;
+                TWI_FrameLength++;
+				TWI_calculatedXOR ^= TWDR;
 			}
 
             // reset TWCR
@@ -151,9 +296,17 @@ ISR(TWI_vect) {
 
         // general call detected
         case TWI_SRX_GEN_ACK:
-			// execute callback when general call received
-			SYNCLK_recordPhaseError();
+			// capture the clock for the phase signal, which is only
+			//   recorded if the call ends without data (see above)
+			SYNCLK_capturePhaseSignal();
 			TWI_isSlaveAddressed = 0;
+			TWI_isGeneralCall = 1;
+
+			// broadcast frames follow the last queued frame
+			TWI_WritePtr = TWI_queue.head;
+			TWI_isBufferAvailable = 1;
+			TWI_RecordState = TWI_RECORD_START;
+			TWI_calculatedXOR = 0;
 
 			// reset TWCR
 			TWCR = TWCR_RESET;
@@ -162,6 +315,11 @@ ISR(TWI_vect) {
         // Previously addressed with general call;
         // data has been received; ACK has been returned
         case TWI_SRX_GEN_DATA_ACK:
+			if (TWI_isGeneralCall) {
+				TWI_calculatedXOR ^= TWDR;
+				_TWI_receiveBroadcast(TWDR);
+			}
+
 			// reset TWCR
 			TWCR = TWCR_RESET;
 			break;
@@ -11,12 +11,12 @@
 
 **********************************************************************/
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
-#include <avr/sleep.h>
-#include <avr/cpufunc.h>
-#include "math.h"
+#include "hal.h"
 #include "waveform_generator.h"
+#include "gamma_table.h"
+
+_Static_assert(WG_GAMMA_TABLE_COUNT <= WG_GAMMA_ENUM_COUNT - 1,
+    "GAMMA_CURVES in the Makefile does not match WaveformGammaCurve");
 
 // private module singleton instance
 static WaveformGenerator _self_waveform_gen;
@@ -35,10 +35,31 @@ void WG_init(uint8_t** channelValueRefs, int channelCount) {
     _self_waveform_gen.channel_1_output = &OCR1BL;
     _self_waveform_gen.channel_2_output = &OCR1AL;
 
+    // the initial (zero) front frame can not match a real update,
+    //  channel 3 is never below PWM_BLUE_MIN_VALUE, so the first 
+    //  update is always published
+    _self_waveform_gen.frameIndex = 0;
+
     // register the wavegen target references
     //  with inputs, expressed as percentages
     while(channelCount--) {
         _self_waveform_gen.channel_target[channelCount] = channelValueRefs[channelCount];
+        _self_waveform_gen.gammaCurve[channelCount] = WG_GAMMA_LINEAR;
+    }
+
+}
+
+// select the brightness correction curve of the channels 
+//  in channelMask (bit 0 == channel 1), curves without a table 
+//  in this build are ignored
+void WG_setGammaCurve(uint8_t channelMask, WaveformGammaCurve curve) {
+
+    if (curve > WG_GAMMA_TABLE_COUNT) return;
+
+    uint8_t channel;
+    for (channel = 0; channel < 3; channel++) {
+        if (channelMask & (1 << channel))
+            _self_waveform_gen.gammaCurve[channel] = curve;
     }
 
 }
@@ -79,14 +100,17 @@ void _WG_configureHardware(void) {
     TCCR0A = ZERO | TCCR0A_CLOCK_DIV64;
 
     // TIMER0 Interrupts
-    // output compare match interrupt
-    TIMSK0 = ZERO | TIMSK0_TOIE0 | TIMSK0_OCIE0B;
+    // overflow and output compare match interrupts are enabled
+    //   while channel 3 is lit, see _WG_latchFrame()
+    TIMSK0 = ZERO;
 
 }
 
 
 // update PWM duty cycle values per the channel target
-//  values, which are stored as percentages
+//  values, which are stored as percentages. The values are
+//  published as a frame, and reach the hardware on the next
+//  timer1 overflow
 void WG_updatePWM(void) {
 
     // rescale channel values to the PWM_MAX_VALUE
@@ -97,11 +121,67 @@ void WG_updatePWM(void) {
     //  Rational: having the channel targets exist as 8-bit values gives the maximum possible resolution
     //  on the user side of the system, yielding input values of 0-255. However, this value should still be 
     //  scaled to the maximum physical duty cycle (presented to LEDs) mandated by hardware.
-    //  Using fmod() here to enforce an input upper limit.
     //
-    uint8_t channel_1_pwm_value = (fmod(*(_self_waveform_gen.channel_target[0]), 256.0)/256.0) * PWM_MAX_VALUE;
-    uint8_t channel_2_pwm_value = (fmod(*(_self_waveform_gen.channel_target[1]), 256.0)/256.0) * PWM_MAX_VALUE;
-    uint8_t channel_3_pwm_value = (fmod(*(_self_waveform_gen.channel_target[2]), 256.0)/256.0) * (PWM_MAX_VALUE-PWM_BLUE_MIN_VALUE) + PWM_BLUE_MIN_VALUE;
+    //  Each value first passes through the channel's brightness curve, giving a
+    //  16-bit level, so that low-end fades keep their resolution until the final 
+    //  rescale. The rescale is a multiply and shift by compile time constants.
+    //
+    uint16_t channel_1_level = _WG_channelLevel(0);
+    uint16_t channel_2_level = _WG_channelLevel(1);
+    uint16_t channel_3_level = _WG_channelLevel(2);
+
+    uint16_t channel_1_pwm_value = WG_SCALE_LEVEL(channel_1_level, PWM_MAX_VALUE);
+    uint16_t channel_2_pwm_value = WG_SCALE_LEVEL(channel_2_level, PWM_MAX_VALUE);
+    uint16_t channel_3_pwm_value = WG_SCALE_LEVEL(channel_3_level, PWM_MAX_VALUE-PWM_BLUE_MIN_VALUE) +
+        (PWM_BLUE_MIN_VALUE << 8);
+
+    // keep only the fractional bits the dither stage uses, so that
+    //  changes below its resolution do not publish a frame
+    channel_1_pwm_value &= WG_DITHER_MASK;
+    channel_2_pwm_value &= WG_DITHER_MASK;
+    channel_3_pwm_value &= WG_DITHER_MASK;
+
+    // drop the frame if nothing has changed since the last one
+    volatile WaveformFrame* front = &_self_waveform_gen.frame[_self_waveform_gen.frameIndex];
+    if (front->channel_pwm[0] == channel_1_pwm_value &&
+        front->channel_pwm[1] == channel_2_pwm_value &&
+        front->channel_pwm[2] == channel_3_pwm_value) return;
+
+    // fill the frame the ISR is not looking at, then publish it. 
+    //  the ISR only ever reads frame[frameIndex], and the index is a 
+    //  single byte, so the swap is atomic
+    uint8_t back_index = _self_waveform_gen.frameIndex ^ 1;
+    volatile WaveformFrame* back = &_self_waveform_gen.frame[back_index];
+    back->channel_pwm[0] = channel_1_pwm_value;
+    back->channel_pwm[1] = channel_2_pwm_value;
+    back->channel_pwm[2] = channel_3_pwm_value;
+
+    _self_waveform_gen.frameIndex = back_index;
+    _self_waveform_gen.isFramePending = 1;
+}
+
+// map a channel value onto its brightness curve, as a 16-bit 
+//  level where full scale is 0xFF00
+uint16_t _WG_channelLevel(uint8_t channel) {
+
+    uint8_t value = *(_self_waveform_gen.channel_target[channel]);
+    uint8_t curve = _self_waveform_gen.gammaCurve[channel];
+
+    if (curve == WG_GAMMA_LINEAR) return (uint16_t)value << 8;
+
+    return pgm_read_word(&_WG_gammaTables[curve - 1][value]);
+
+}
+
+// apply the last published frame to the output hardware, called
+//  from the timer1 overflow ISR so all channels change together at
+//  the start of a PWM period. With dithering, this runs every period
+void _WG_latchFrame(void) {
+
+    volatile WaveformFrame* frame = &_self_waveform_gen.frame[_self_waveform_gen.frameIndex];
+
+    uint8_t channel_1_pwm_value = _WG_ditherChannel(0, frame->channel_pwm[0]);
+    uint8_t channel_2_pwm_value = _WG_ditherChannel(1, frame->channel_pwm[1]);
 
     // assign chan1& chan2 values directly to PWM timers
     *(_self_waveform_gen.channel_1_output) = channel_1_pwm_value;
@@ -113,29 +193,77 @@ void WG_updatePWM(void) {
     //  will actually either (1) blip the output pin high before 
     //  reaching the OCRx value, or (2) miss the OCRx value completely
     //  and produce a 100% duty cycle. Either condition is not desirable
+    uint8_t output_enable = 0;
+    if (channel_1_pwm_value != 0) output_enable |= WG_CHANNEL_1_PIN;
+    if (channel_2_pwm_value != 0) output_enable |= WG_CHANNEL_2_PIN;
+    DDRB = (DDRB & ~(WG_CHANNEL_1_PIN | WG_CHANNEL_2_PIN)) | output_enable;
 
-    // set pins to input mode, if value is actually zero
-    if (channel_1_pwm_value == 0) DDRB &= 0b11111011;   //PB2 reset to input
-    else DDRB |= 0b00000100;                            //PB2 set to output
+    // The following is a similar implementation of the above thresholding logic
+    //  but for the (non-hardware pwm) ch3 output, which is picked up by
+    //  timer0 at the start of its next PWM period. Timer0 takes one value
+    //  per WG_TIMER0_PERIOD_TICKS timer1 periods, and its dither sequence 
+    //  advances at that rate
+#if PWM_DITHER_BITS > 0
+    if (++_self_waveform_gen.channel_3_ticks >= WG_TIMER0_PERIOD_TICKS) {
+        _self_waveform_gen.channel_3_ticks = 0;
+#else
+    {
+#endif
+        uint8_t channel_3_pwm_value = _WG_ditherChannel(2, frame->channel_pwm[2]);
+
+        // ch3 is disabled if value is less than PWM_MIN_VALUE, by
+        //  masking the timer0 interrupts, so that an unlit channel 
+        //  costs no interrupts at all
+        uint8_t channel_3_enable = (channel_3_pwm_value > PWM_BLUE_MIN_VALUE);
+        _self_waveform_gen.channel_3_output = channel_3_pwm_value;
+
+        if (channel_3_enable != _self_waveform_gen.channel_3_enable) {
+            _self_waveform_gen.channel_3_enable = channel_3_enable;
+            if (channel_3_enable) {
+                // discard flags raised while masked, the first
+                //  period starts at the next overflow
+                TIFR0 = TIFR0_TOV0 | TIFR0_OCF0B;
+                TIMSK0 = ZERO | TIMSK0_TOIE0 | TIMSK0_OCIE0B;
+            } else {
+                TIMSK0 = ZERO;
+                PORTB &= ~WG_CHANNEL_3_PIN;
+            }
+        }
+    }
 
-    // set pins to input mode, if value is actually zero
-    if (channel_2_pwm_value == 0) DDRB &= 0b11111101;   //PB1 reset to input
-    else DDRB |= 0b00000010;                            //PB1 set to output
-	
-	// set pins to input mode, if value is less than PWM_MIN_VALUE
-	if (channel_3_pwm_value <= PWM_BLUE_MIN_VALUE) _self_waveform_gen.channel_3_enable = 0;
-	else _self_waveform_gen.channel_3_enable = 1;
+    _self_waveform_gen.isFramePending = 0;
 
-    // The following is a similar implementation of the above thresholding logic
-    //  but for the (non-hardware pwm) ch3 output
+}
+
+// output value of a channel for the next PWM period; the 
+//  accumulated fraction overflows into an extra count
+uint8_t _WG_ditherChannel(uint8_t channel, uint16_t pwm_value) {
+
+    uint8_t pwm_count = pwm_value >> 8;
+
+#if PWM_DITHER_BITS > 0
+    uint8_t error = _self_waveform_gen.ditherError[channel];
+    uint8_t new_error = error + (uint8_t)pwm_value;
+    _self_waveform_gen.ditherError[channel] = new_error;
+    if (new_error < error) pwm_count++;
+#endif
+
+    return pwm_count;
 
-    // assign channel 3 value to a proxy
-    _self_waveform_gen.channel_3_output = channel_3_pwm_value;
 }
 
 // execute a callback on timer1 overflow
 ISR(TIMER1_OVF_vect) {
 
+    // latch a newly published output frame, or with dithering 
+    //  the next value of the current one
+#if PWM_DITHER_BITS > 0
+    _WG_latchFrame();
+#else
+    if (_self_waveform_gen.isFramePending)
+        _WG_latchFrame();
+#endif
+
     // mark time in light manager, this advances the 
     // animation clock
     if (_self_waveform_gen.overflowCallback)
@@ -143,27 +271,53 @@ ISR(TIMER1_OVF_vect) {
  
 }
 
-ISR(TIMER0_OVF_vect) {
-
-    // set compare register value
+// Implement Channel 3 PWM Signal 
+//  timer0 interrupts are only enabled while channel 3 is on (see 
+//  _WG_latchFrame), so both ISRs are unconditional. They are naked, 
+//  and use only instructions which leave SREG alone, so the overflow
+//  ISR saves just the one register it needs and the compare ISR none
+//  at all. This keeps their blocking time short for TWI and timer1
+//  (counted with the 4 cycle interrupt response and the vector jump:
+//  20 cycles for the overflow ISR, 12 for the compare ISR)
+//  the build checks their disassembly, see tools/check_isr.py
+ISR(TIMER0_OVF_vect, ISR_NAKED) {
+
+#ifdef HOST_BUILD
     OCR0B = _self_waveform_gen.channel_3_output;
-
-    // if channel 3 value is below threshold,
-    // do not turn on the output pin at all
-    if (_self_waveform_gen.channel_3_enable) {
-        // set channel 3 output pin at start of PWM cycle
-        PORTB |= 0b00000001; 
-    } else { 
-        // keep output off if below threshold
-        PORTB &= 0b11111110;
-    }
+    PORTB |= WG_CHANNEL_3_PIN;
+#else
+    // set compare register value, and set channel 3 output 
+    //  pin at start of PWM cycle
+    __asm__ __volatile__ (
+        "push r24"                  "\n\t"
+        "lds r24, %[value]"         "\n\t"
+        "sts %[compare], r24"       "\n\t"
+        "sbi %[port], %[pin]"       "\n\t"
+        "pop r24"                   "\n\t"
+        "reti"                      "\n\t"
+        :
+        : [value] "i" (&_self_waveform_gen.channel_3_output),
+          [compare] "n" (_SFR_MEM_ADDR(OCR0B)),
+          [port] "I" (_SFR_IO_ADDR(PORTB)),
+          [pin] "I" (WG_CHANNEL_3_BIT)
+    );
+#endif
 
 }
 
-// Implement Channel 3 PWM Signal 
-ISR(TIMER0_COMPB_vect) {
+ISR(TIMER0_COMPB_vect, ISR_NAKED) {
 
+#ifdef HOST_BUILD
+    PORTB &= ~WG_CHANNEL_3_PIN;
+#else
     // reset channel 3 output pin on compare match
-    PORTB &= 0b11111110;
+    __asm__ __volatile__ (
+        "cbi %[port], %[pin]"       "\n\t"
+        "reti"                      "\n\t"
+        :
+        : [port] "I" (_SFR_IO_ADDR(PORTB)),
+          [pin] "I" (WG_CHANNEL_3_BIT)
+    );
+#endif
 
-}
\ No newline at end of file
+}
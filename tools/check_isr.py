@@ -0,0 +1,103 @@
+#!/usr/bin/env python
+#######################################################################
+#
+#  check_isr.py - checks the disassembly of naked ISRs. A naked ISR
+#    has no compiler prologue, so it may only use the registers it
+#    saves itself and no instruction which changes SREG (see the
+#    timer0 ISRs in waveform_generator.c).
+#
+#    Usage:
+#      avr-objdump -d image.elf | check_isr.py register[,register] vector...
+#      (or llvm-objdump -d --mcpu=attiny88)
+#
+#    Every instruction of each vector is checked against a list of
+#    instructions which leave SREG alone, and every register operand
+#    against the allowed registers. "-" allows no registers. Fails if
+#    a vector is missing, or does not end in reti.
+#
+#
+#  Authors:
+#    Nate Fisher
+#
+#  Created:
+#    Wed Oct 1, 2014
+#
+#######################################################################
+
+import re
+import sys
+
+# instructions which do not write SREG, as long as they do not
+#   address SREG itself (I/O 0x3f, data 0x5f)
+SREG_SAFE = set([
+    'push', 'pop', 'lds', 'sts', 'ld', 'st', 'ldd', 'std', 'ldi',
+    'mov', 'movw', 'in', 'out', 'sbi', 'cbi', 'lpm', 'nop', 'reti',
+])
+SREG_ADDRESSES = set([0x3f, 0x5f])
+
+SYMBOL = re.compile(r'^[0-9a-fA-F]+ <([^>]+)>:')
+INSTRUCTION = re.compile(r'^\s*[0-9a-fA-F]+:\s+(?:[0-9a-fA-F]{2} )+\s*(\S+)\s*([^;]*)')
+REGISTER = re.compile(r'\br([0-9]+)\b')
+NUMBER = re.compile(r'\b(0x[0-9a-fA-F]+|[0-9]+)\b')
+
+def read_functions(lines):
+    functions = {}
+    current = None
+    for line in lines:
+        match = SYMBOL.match(line)
+        if match:
+            current = functions.setdefault(match.group(1), [])
+            continue
+        match = INSTRUCTION.match(line)
+        if match and current is not None:
+            current.append((match.group(1), match.group(2).strip()))
+    return functions
+
+def check(name, instructions, allowed):
+    errors = []
+    if not instructions:
+        return ['%s: not found' % name]
+    for mnemonic, operands in instructions:
+        text = '%s: %s %s' % (name, mnemonic, operands)
+        if mnemonic.startswith('<') or mnemonic.startswith('.'):
+            errors.append(text + ' is not an instruction')
+            continue
+        if mnemonic not in SREG_SAFE:
+            errors.append(text + ' may change SREG')
+            continue
+        registers = set(int(r) for r in REGISTER.findall(operands))
+        for register in sorted(registers - allowed):
+            errors.append(text + ' uses r%d' % register)
+        if mnemonic in ('in', 'out', 'lds', 'sts'):
+            addresses = set(int(n, 0) for n in NUMBER.findall(REGISTER.sub('', operands)))
+            if addresses & SREG_ADDRESSES:
+                errors.append(text + ' accesses SREG')
+    if instructions[-1][0] != 'reti':
+        errors.append('%s: does not end in reti' % name)
+    return errors
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write('usage: check_isr.py register[,register] vector...\n')
+        return 2
+
+    allowed = set()
+    if argv[1] != '-':
+        allowed = set(int(r.lstrip('r')) for r in argv[1].split(','))
+
+    functions = read_functions(sys.stdin.readlines())
+
+    errors = []
+    for name in argv[2:]:
+        found = functions.get(name, [])
+        errors += check(name, found, allowed)
+        if found:
+            sys.stdout.write('%s: %d instructions\n' % (name, len(found)))
+
+    for error in errors:
+        sys.stdout.write(error + '\n')
+
+    return 1 if errors else 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
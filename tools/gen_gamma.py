@@ -0,0 +1,77 @@
+#!/usr/bin/env python
+#######################################################################
+#
+#  gen_gamma.py - generates the brightness correction tables used by
+#    the waveform generator (see WG_updatePWM). Each table maps an
+#    8-bit pattern value onto a 16-bit output level, where full scale
+#    (value 255) is 0xFF00 so that the linear curve is simply value<<8.
+#
+#    Usage:
+#      gen_gamma.py output.h curve [curve...]
+#
+#    A curve is either a gamma exponent ("2.2") or "cie" for the
+#    CIE 1931 lightness curve. Tables are emitted in the order given,
+#    which must match WaveformGammaCurve in waveform_generator.h
+#    (the linear curve is computed, and has no table).
+#
+#
+#  Authors:
+#    Nate Fisher
+#
+#  Created:
+#    Wed Oct 1, 2014
+#
+#######################################################################
+
+import sys
+
+FULL_SCALE = 0xFF00
+
+def gamma_curve(exponent):
+    return lambda x: x ** exponent
+
+# CIE 1931 lightness, x is L* scaled to 0..1
+def cie_curve(x):
+    lightness = x * 100.0
+    if lightness <= 8.0:
+        return lightness / 903.3
+    return ((lightness + 16.0) / 116.0) ** 3
+
+def parse_curve(name):
+    if name == 'cie':
+        return 'CIE 1931 lightness', cie_curve
+    return 'gamma %s' % name, gamma_curve(float(name))
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write('usage: gen_gamma.py output.h curve [curve...]\n')
+        return 2
+
+    curves = [parse_curve(name) for name in argv[2:]]
+
+    lines = []
+    lines.append('// generated by tools/gen_gamma.py, do not edit')
+    lines.append('#ifndef  GAMMA_TABLE_H')
+    lines.append('#define  GAMMA_TABLE_H')
+    lines.append('')
+    lines.append('#define WG_GAMMA_TABLE_COUNT  %d' % len(curves))
+    lines.append('')
+    lines.append('static const uint16_t _WG_gammaTables[WG_GAMMA_TABLE_COUNT][256] PROGMEM = {')
+    for description, curve in curves:
+        levels = [int(round(FULL_SCALE * curve(value / 255.0))) for value in range(256)]
+        lines.append('    // %s' % description)
+        lines.append('    {')
+        for row in range(0, 256, 8):
+            lines.append('        ' + ', '.join('0x%04X' % level for level in levels[row:row + 8]) + ',')
+        lines.append('    },')
+    lines.append('};')
+    lines.append('')
+    lines.append('#endif')
+
+    with open(argv[1], 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
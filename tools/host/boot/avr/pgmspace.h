@@ -0,0 +1,2 @@
+// see hal_boot.h
+#include "../hal_boot.h"
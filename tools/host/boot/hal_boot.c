@@ -0,0 +1,98 @@
+/**********************************************************************
+
+  hal_boot.c - implementation, see header for description
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hal_boot.h"
+
+volatile uint8_t TWAR, TWCR, TWDR, TWSR;
+
+uint8_t HAL_flash[HAL_FLASH_SIZE];
+uint8_t HAL_eeprom[HAL_EEPROM_SIZE];
+uint32_t HAL_nvmTime;
+
+// temporary page buffer filled by boot_page_fill
+static uint8_t _HAL_pageBuffer[SPM_PAGESIZE];
+
+static uint16_t _HAL_flashPage(uint32_t address) {
+
+    if (address >= HAL_FLASH_SIZE) {
+        fprintf(stderr, "flash access out of range: 0x%04lx\n", (unsigned long)address);
+        abort();
+    }
+    return address & ~(SPM_PAGESIZE - 1);
+
+}
+
+static uint16_t _HAL_eepromAddress(const void* address) {
+
+    uintptr_t offset = (uintptr_t)address;
+    if (offset >= HAL_EEPROM_SIZE) {
+        fprintf(stderr, "eeprom access out of range: 0x%04lx\n", (unsigned long)offset);
+        abort();
+    }
+    return offset;
+
+}
+
+void boot_page_erase(uint32_t address) {
+
+    memset(&HAL_flash[_HAL_flashPage(address)], 0xFF, SPM_PAGESIZE);
+    HAL_nvmTime += HAL_SPM_ERASE_US;
+
+}
+
+void boot_page_fill(uint32_t address, uint16_t data) {
+
+    uint8_t offset = address & (SPM_PAGESIZE - 2);
+    _HAL_pageBuffer[offset] = data;
+    _HAL_pageBuffer[offset + 1] = data >> 8;
+
+}
+
+void boot_page_write(uint32_t address) {
+
+    memcpy(&HAL_flash[_HAL_flashPage(address)], _HAL_pageBuffer, SPM_PAGESIZE);
+    HAL_nvmTime += HAL_SPM_WRITE_US;
+
+}
+
+uint8_t eeprom_read_byte(const uint8_t* address) {
+
+    return HAL_eeprom[_HAL_eepromAddress(address)];
+
+}
+
+uint16_t eeprom_read_word(const uint16_t* address) {
+
+    uint16_t offset = _HAL_eepromAddress(address);
+    return HAL_eeprom[offset] | (HAL_eeprom[_HAL_eepromAddress((const uint8_t*)address + 1)] << 8);
+
+}
+
+void eeprom_write_byte(uint8_t* address, uint8_t value) {
+
+    HAL_eeprom[_HAL_eepromAddress(address)] = value;
+    HAL_nvmTime += HAL_EEPROM_WRITE_US;
+
+}
+
+void eeprom_update_word(uint16_t* address, uint16_t value) {
+
+    uint16_t offset = _HAL_eepromAddress(address);
+    HAL_eeprom[offset] = value & 0xFF;
+    HAL_eeprom[_HAL_eepromAddress((uint8_t*)address + 1)] = value >> 8;
+    HAL_nvmTime += 2 * HAL_EEPROM_WRITE_US;
+
+}
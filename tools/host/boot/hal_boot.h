@@ -0,0 +1,76 @@
+/**********************************************************************
+
+  hal_boot.h - host stand in for the avr-libc headers used by the
+    bootloader (bootloader/src/boot_manager.c). Registers are 
+    ordinary bytes, flash and eeprom are emulated in memory, and 
+    flash and eeprom writes add their duration to HAL_nvmTime 
+    instead of halting the CPU. The avr/ and util/ headers beside this one 
+    include it.
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#ifndef  HAL_BOOT_H
+#define  HAL_BOOT_H
+
+#include <stdint.h>
+
+// registers
+extern volatile uint8_t TWAR, TWCR, TWDR, TWSR;
+
+#define TWINT   7
+#define TWEA    6
+#define TWSTA   5
+#define TWSTO   4
+#define TWEN    2
+
+// ATtiny88
+#define HAL_FLASH_SIZE      8192
+#define HAL_EEPROM_SIZE     64
+#define SPM_PAGESIZE        64
+
+// page erase, page write and eeprom byte write times, us
+#define HAL_SPM_ERASE_US    4500
+#define HAL_SPM_WRITE_US    4500
+#define HAL_EEPROM_WRITE_US 3400
+
+extern uint8_t HAL_flash[HAL_FLASH_SIZE];
+extern uint8_t HAL_eeprom[HAL_EEPROM_SIZE];
+extern uint32_t HAL_nvmTime;
+
+// program memory: integer addresses read the emulated flash, the
+//   address of a PROGMEM constant is an ordinary host pointer
+#define PROGMEM
+#define _HAL_pgmRead(address, type) \
+    _Generic((address), \
+        const type*: *(const type*)(uintptr_t)(address), \
+        type*: *(const type*)(uintptr_t)(address), \
+        default: (type)(HAL_flash[(uint16_t)(uintptr_t)(address)] | \
+            (sizeof(type) > 1 ? HAL_flash[(uint16_t)((uintptr_t)(address) + 1)] << 8 : 0)))
+#define pgm_read_byte(address)  _HAL_pgmRead(address, uint8_t)
+#define pgm_read_word(address)  _HAL_pgmRead(address, uint16_t)
+
+// self programming
+void boot_page_erase(uint32_t);
+void boot_page_fill(uint32_t, uint16_t);
+void boot_page_write(uint32_t);
+#define boot_spm_busy_wait()
+
+// eeprom
+uint8_t eeprom_read_byte(const uint8_t*);
+uint16_t eeprom_read_word(const uint16_t*);
+void eeprom_write_byte(uint8_t*, uint8_t);
+void eeprom_update_word(uint16_t*, uint16_t);
+#define eeprom_busy_wait()
+
+// delays do not need to take any time on the host
+#define _delay_ms(ms)
+#define _delay_us(us)
+
+#endif
@@ -0,0 +1,169 @@
+/**********************************************************************
+
+  dither_test.c - checks the temporal dithering of the waveform
+    generator (PWM_DITHER_BITS, see waveform_generator.h), built with
+    dithering on whatever the Makefile default is (HOST_DITHER_BITS).
+
+    Every channel value 0 ~ 255 is published on all three channels,
+    through each brightness curve in the build, and the timer1
+    overflow ISR is run for one dither cycle, 2^PWM_DITHER_BITS PWM
+    periods, of channel 3 (which takes one value per timer0 period,
+    WG_TIMER0_PERIOD_TICKS timer1 periods), so channels 1 and 2 run
+    WG_TIMER0_PERIOD_TICKS cycles. The output counts of each cycle,
+    with the output disabled counted as 0, must sum to
+    the fractional target times 2^PWM_DITHER_BITS exactly: the target
+    is the channel level scaled onto the PWM range, and truncated to
+    PWM_DITHER_BITS fractional bits.
+
+    Channel 3 is off at PWM_BLUE_MIN_VALUE counts and below, so a
+    target under PWM_BLUE_MIN_VALUE + 1 can not be averaged and is
+    not checked.
+
+    Usage:
+      dither_test [-v]
+
+      -v  print every failing cycle
+
+    Exits non-zero if any value fails.
+
+
+  Authors:
+    Nate Fisher
+
+  Created:
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "waveform_generator.h"
+#include "gamma_table.h"
+
+#if PWM_DITHER_BITS < 1
+#error "dither_test needs PWM_DITHER_BITS above 0"
+#endif
+
+// PWM periods per dither cycle
+#define DITHER_TEST_PERIODS     (1U << PWM_DITHER_BITS)
+
+void TIMER1_OVF_vect(void);
+void TIMER0_OVF_vect(void);
+
+static uint8_t _isVerbose;
+
+// target of a channel level, in 1/DITHER_TEST_PERIODS counts
+static uint32_t _target(uint16_t level, uint8_t range, uint8_t offset) {
+
+    return ((((uint32_t)level * range) >> 16) + offset) * DITHER_TEST_PERIODS +
+        ((((uint32_t)level * range) & 0xFFFF) >> (16 - PWM_DITHER_BITS));
+
+}
+
+// run one dither cycle of channel 3, WG_TIMER0_PERIOD_TICKS cycles of
+//   channels 1 and 2, and sum the output counts of each cycle
+static void _runCycle(uint32_t sum[WG_TIMER0_PERIOD_TICKS][3]) {
+
+    uint32_t period;
+    uint8_t tick;
+    for (period = 0; period < DITHER_TEST_PERIODS; period++) {
+        for (tick = 0; tick < WG_TIMER0_PERIOD_TICKS; tick++) {
+            TIMER1_OVF_vect();
+
+            // channels 1 and 2 change every timer1 period
+            uint32_t* cycle = sum[(period * WG_TIMER0_PERIOD_TICKS + tick) / DITHER_TEST_PERIODS];
+            if (DDRB & WG_CHANNEL_1_PIN) cycle[0] += OCR1BL;
+            if (DDRB & WG_CHANNEL_2_PIN) cycle[1] += OCR1AL;
+        }
+
+        // channel 3 takes its next value at the timer0 overflow
+        if (TIMSK0 & TIMSK0_TOIE0) {
+            TIMER0_OVF_vect();
+            sum[0][2] += OCR0B;
+        }
+    }
+
+}
+
+// publish a value on all channels, returns the number of failing cycles
+static uint8_t _runValue(uint8_t* values, uint8_t value, WaveformGammaCurve curve) {
+
+    values[0] = values[1] = values[2] = value;
+    WG_updatePWM();
+
+    // the first periods may still show the previous frame
+    static uint32_t sum[WG_TIMER0_PERIOD_TICKS][3];
+    _runCycle(sum);
+    memset(sum, 0, sizeof(sum));
+    _runCycle(sum);
+
+    uint32_t target[3];
+    target[0] = _target(_WG_channelLevel(0), PWM_MAX_VALUE, 0);
+    target[1] = _target(_WG_channelLevel(1), PWM_MAX_VALUE, 0);
+    target[2] = _target(_WG_channelLevel(2), PWM_MAX_VALUE - PWM_BLUE_MIN_VALUE, PWM_BLUE_MIN_VALUE);
+
+    uint8_t failures = 0;
+    uint8_t cycle;
+    uint8_t channel;
+    for (cycle = 0; cycle < WG_TIMER0_PERIOD_TICKS; cycle++) {
+        for (channel = 0; channel < 3; channel++) {
+            if (channel == 2) {
+                if (cycle > 0) continue;
+                if (target[channel] < (PWM_BLUE_MIN_VALUE + 1) * DITHER_TEST_PERIODS)
+                    continue;
+            }
+            if (sum[cycle][channel] == target[channel]) continue;
+
+            failures++;
+            if (_isVerbose)
+                printf("  curve %u value %u channel %u cycle %u: average %u/%u, target %u/%u\n",
+                    curve, value, channel + 1, cycle, (unsigned)sum[cycle][channel],
+                    DITHER_TEST_PERIODS, (unsigned)target[channel], DITHER_TEST_PERIODS);
+        }
+    }
+
+    return failures;
+
+}
+
+int main(int argc, char* argv[]) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        switch (opt) {
+            case 'v': _isVerbose = 1; break;
+            default:
+                fprintf(stderr, "usage: dither_test [-v]\n");
+                return 2;
+        }
+    }
+
+    uint8_t values[3] = {0, 0, 0};
+    uint8_t* refs[3] = {&values[0], &values[1], &values[2]};
+    WG_init(refs, 3);
+
+    uint32_t failedCurves = 0;
+    uint8_t curve;
+    for (curve = WG_GAMMA_LINEAR; curve <= WG_GAMMA_TABLE_COUNT; curve++) {
+        WG_setGammaCurve(0b111, curve);
+
+        uint32_t failures = 0;
+        uint16_t value;
+        for (value = 0; value < 256; value++)
+            failures += _runValue(values, value, curve);
+
+        printf("curve %u, %u dither bits: ", curve, PWM_DITHER_BITS);
+        if (failures) {
+            printf("%u channel cycles off target\n", (unsigned)failures);
+            failedCurves++;
+        } else {
+            printf("ok\n");
+        }
+    }
+
+    return failedCurves ? 1 : 0;
+
+}
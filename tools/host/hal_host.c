@@ -0,0 +1,76 @@
+/**********************************************************************
+
+  hal_host.c - implementation, see header for description
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include "hal_host.h"
+
+volatile uint8_t SREG, MCUSR, WDTCSR, SMCR, SPCR, PCICR;
+volatile uint8_t DDRB, PORTB, PINB, DDRD, PORTD, PIND;
+volatile uint8_t TCCR0A, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, OCR1AL, OCR1BL, TIMSK1, TIFR1;
+volatile uint8_t TWAR, TWCR, TWDR, TWSR;
+
+uint8_t HAL_eeprom[HAL_EEPROM_SIZE];
+
+// set by the host driver to regain control on a firmware reset
+jmp_buf* HAL_resetTarget;
+
+static uint16_t _HAL_eepromAddress(const void* address) {
+
+    uintptr_t offset = (uintptr_t)address;
+    if (offset >= HAL_EEPROM_SIZE) {
+        fprintf(stderr, "eeprom access out of range: 0x%04lx\n", (unsigned long)offset);
+        abort();
+    }
+    return offset;
+
+}
+
+uint8_t eeprom_read_byte(const uint8_t* address) {
+
+    return HAL_eeprom[_HAL_eepromAddress(address)];
+
+}
+
+uint16_t eeprom_read_word(const uint16_t* address) {
+
+    uint16_t offset = _HAL_eepromAddress(address);
+    return HAL_eeprom[offset] | (HAL_eeprom[_HAL_eepromAddress((const uint8_t*)address + 1)] << 8);
+
+}
+
+void eeprom_write_byte(uint8_t* address, uint8_t value) {
+
+    HAL_eeprom[_HAL_eepromAddress(address)] = value;
+
+}
+
+void eeprom_update_word(uint16_t* address, uint16_t value) {
+
+    uint16_t offset = _HAL_eepromAddress(address);
+    HAL_eeprom[offset] = value & 0xFF;
+    HAL_eeprom[_HAL_eepromAddress((uint8_t*)address + 1)] = value >> 8;
+
+}
+
+void HAL_wdtEnable(uint8_t timeout) {
+
+    (void)timeout;
+    if (HAL_resetTarget) longjmp(*HAL_resetTarget, 1);
+
+    fprintf(stderr, "watchdog reset requested\n");
+    exit(0);
+
+}
@@ -0,0 +1,119 @@
+/**********************************************************************
+
+  hal_host.h - host side of the hardware abstraction layer, see 
+    include/hal.h. Each AVR register used by the firmware is an 
+    ordinary byte, ISR() declares a plain function named after its 
+    vector, and flash/eeprom/watchdog access is emulated in memory.
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#ifndef  HAL_HOST_H
+#define  HAL_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <setjmp.h>
+
+// registers
+#define HAL_REGISTER(name)  extern volatile uint8_t name;
+
+HAL_REGISTER(SREG)
+HAL_REGISTER(MCUSR)
+HAL_REGISTER(WDTCSR)
+HAL_REGISTER(SMCR)
+HAL_REGISTER(SPCR)
+HAL_REGISTER(PCICR)
+HAL_REGISTER(DDRB)
+HAL_REGISTER(PORTB)
+HAL_REGISTER(PINB)
+HAL_REGISTER(DDRD)
+HAL_REGISTER(PORTD)
+HAL_REGISTER(PIND)
+HAL_REGISTER(TCCR0A)
+HAL_REGISTER(TCNT0)
+HAL_REGISTER(OCR0A)
+HAL_REGISTER(OCR0B)
+HAL_REGISTER(TIMSK0)
+HAL_REGISTER(TIFR0)
+HAL_REGISTER(TCCR1A)
+HAL_REGISTER(TCCR1B)
+HAL_REGISTER(OCR1AL)
+HAL_REGISTER(OCR1BL)
+HAL_REGISTER(TIMSK1)
+HAL_REGISTER(TIFR1)
+HAL_REGISTER(TWAR)
+HAL_REGISTER(TWCR)
+HAL_REGISTER(TWDR)
+HAL_REGISTER(TWSR)
+
+// register bits
+#define TWINT   7
+#define TWEA    6
+#define TWSTA   5
+#define TWSTO   4
+#define TWWC    3
+#define TWEN    2
+#define TWIE    0
+
+#define WDIF    7
+#define WDIE    6
+#define WDP3    5
+#define WDCE    4
+#define WDE     3
+#define WDP2    2
+#define WDP1    1
+#define WDP0    0
+#define WDRF    3
+
+#define WDTO_15MS   0
+
+// interrupts; vectors are plain functions on the host
+#define ISR(vector, ...)    void vector(void); void vector(void)
+#define ISR_NAKED
+#define sei()               (SREG |= 0x80)
+#define cli()               (SREG &= 0x7F)
+
+// sleep, the host never sleeps
+#define SLEEP_MODE_IDLE         0
+#define set_sleep_mode(mode)    (SMCR = (SMCR & 0xF1) | (mode))
+#define sleep_enable()          (SMCR |= 0x01)
+#define sleep_disable()         (SMCR &= 0xFE)
+#define sleep_cpu()
+
+// program memory is ordinary memory on the host
+#define PROGMEM
+#define pgm_read_byte(address)  (*(const uint8_t*)(address))
+#define pgm_read_word(address)  (*(const uint16_t*)(address))
+#define memcpy_P(dest, src, n)  memcpy(dest, src, n)
+
+// eeprom, backed by HAL_eeprom
+#define HAL_EEPROM_SIZE     64
+extern uint8_t HAL_eeprom[HAL_EEPROM_SIZE];
+
+uint8_t eeprom_read_byte(const uint8_t*);
+uint16_t eeprom_read_word(const uint16_t*);
+void eeprom_write_byte(uint8_t*, uint8_t);
+void eeprom_update_word(uint16_t*, uint16_t);
+#define eeprom_busy_wait()
+
+// watchdog; enabling it is how the firmware resets itself, 
+//   HAL_wdtEnable() hands control back to the host driver
+extern jmp_buf* HAL_resetTarget;
+void HAL_wdtEnable(uint8_t);
+#define wdt_enable(timeout) HAL_wdtEnable(timeout)
+#define wdt_disable()
+#define wdt_reset()
+
+// delays do not need to take any time on the host
+#define _delay_ms(ms)
+#define _delay_us(us)
+
+#endif
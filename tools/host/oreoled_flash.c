@@ -0,0 +1,639 @@
+/**********************************************************************
+
+  oreoled_flash.c - host side flashing tool for the bootloader, run
+    against a simulated node. Links the bootloader command handler
+    (bootloader/src/boot_manager.c) built against the host stand in
+    for avr-libc (tools/host/boot), and acts as the TWI master: each
+    transaction is delivered the way the bootloader TWI manager
+    presents it, followed by the same sequence as the bootloader
+    mainloop.
+
+    A random (or given) application image is flashed with each write command
+    and the total update time is measured. The bus is modelled at
+    9 bit times per byte plus START and STOP; while the node erases
+    and programs a page (or writes the eeprom) the CPU halts and the
+    next transaction is clock stretched until it is done. After
+    finalising, the flash status and application checksum of each
+    node are read back and its emulated flash is compared against 
+    the image.
+
+    Each node starts with an installed application: the image with a
+    few random bytes changed, or the application given with -I. The
+    delta mode reads the page hashes of the installed application and
+    writes only the pages that differ from the new image.
+
+    Nodes are simulated one after the other. The unicast modes flash
+    each node in turn, while a broadcast is received by every node at
+    once, so its bus time counts once however many nodes there are.
+
+    Modes:
+      ab           BOOT_CMD_WRITE_FLASH_A/B, reading every reply
+      ab-stream    BOOT_CMD_WRITE_FLASH_A/B, replies skipped
+      page         BOOT_CMD_WRITE_FLASH_PAGE, reading every reply
+      page-stream  BOOT_CMD_WRITE_FLASH_PAGE, replies skipped
+      broadcast    BOOT_CMD_WRITE_FLASH_PAGE to every node by general call
+      delta        BOOT_CMD_PAGE_HASH, then BOOT_CMD_WRITE_FLASH_PAGE for the
+                   pages that changed, replies skipped
+
+    Usage:
+      oreoled_flash [-m mode] [-k khz] [-l pages] [-c nodes] [-r seed]
+                    [-i image.hex] [-I installed.hex] [-p bytes]
+
+      -m  write mode, see above (default all of them)
+      -k  bus clock in kHz (default 100)
+      -l  application length in pages (default the whole application
+          section)
+      -c  number of nodes, stations 0 ~ N-1 (default 1)
+      -r  random seed for the image
+      -i  flash this Intel HEX image instead of a random one
+      -I  Intel HEX image installed on the nodes
+      -p  without -I, bytes of the image changed at random in the
+          installed application (default 16)
+
+
+  Authors:
+    Nate Fisher
+
+  Created:
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hal_boot.h"
+#include "twi_manager.h"
+#include "boot_manager.h"
+
+#define FLASH_APP_PAGES         (BOOTLOADER_START / SPM_PAGESIZE)
+#define FLASH_APP_VERSION       0x0102
+
+typedef enum {
+    FLASH_MODE_AB,
+    FLASH_MODE_AB_STREAM,
+    FLASH_MODE_PAGE,
+    FLASH_MODE_PAGE_STREAM,
+    FLASH_MODE_BROADCAST,
+    FLASH_MODE_DELTA,
+    FLASH_MODE_COUNT
+} FlashMode;
+
+static const char* _modeNames[FLASH_MODE_COUNT] = {
+    "ab", "ab-stream", "page", "page-stream", "broadcast", "delta"
+};
+
+uint8_t NODE_station;
+
+static uint8_t _image[BOOTLOADER_START];
+static uint8_t _installed[BOOTLOADER_START];
+static uint16_t _installedLength;
+static uint8_t _reply[TWI_SLR_BUFFER_SIZE];
+static uint8_t _replyLength;
+
+static double _bitTime;         // us
+static double _now;             // us
+static double _nodeBusyUntil;   // us
+static uint32_t _transactions;
+static uint32_t _busBytes;
+static double _busTime;         // us
+static uint8_t _lastCRC;
+static uint8_t _isBroadcast;    // master writes by general call
+static uint8_t _pagesWritten;
+static uint8_t _errors;
+
+// node side: the bootloader TWI manager hands the reply to the master
+void TWI_SetReply(uint8_t *buf, uint8_t len) {
+
+    if (len > sizeof(_reply)) {
+        len = sizeof(_reply);
+    }
+    if (TWI_isBroadcast) {
+        len = 0;
+    }
+    memcpy(_reply, buf, len);
+    _replyLength = len;
+    TWI_readIsBusy = !TWI_isBroadcast;
+
+}
+
+// node side: one pass of the bootloader mainloop after a transaction,
+//   the CPU halts while the flash and eeprom are written
+static void _FLASH_runNode(void) {
+
+    uint32_t nvmTime = HAL_nvmTime;
+
+    BOOT_processBuffer();
+
+    if (!TWI_readIsBusy) {
+        while (BOOT_waitingToFlash)
+            BOOT_write_flash_page();
+
+        if (BOOT_waitingToFinalise)
+            BOOT_finalise_flash();
+    }
+
+    _nodeBusyUntil = _now + (HAL_nvmTime - nvmTime);
+
+}
+
+// master side: START, SLA, bytes, STOP, stretched while the node is busy
+static void _FLASH_busTransaction(uint8_t length) {
+
+    if (_now < _nodeBusyUntil) {
+        _now = _nodeBusyUntil;
+    }
+    _busTime += (2 + 9 * (1 + length)) * _bitTime;
+    _now += (2 + 9 * (1 + length)) * _bitTime;
+    _busBytes += 1 + length;
+    _transactions++;
+
+}
+
+// node side: received as the bootloader TWI manager does, the last
+//   byte is the master's XOR
+static void _FLASH_receive(uint8_t isGeneralCall, const uint8_t* data, uint8_t length) {
+
+    uint8_t i;
+
+    TWI_Ptr = 0;
+    TWI_isBroadcast = isGeneralCall;
+    TWI_BufferXOR = isGeneralCall ? 0x00 : (TWAR >> 1);
+    for (i = 0; i < length && TWI_Ptr < TWI_SLW_BUFFER_SIZE; i++) {
+        TWI_Buffer[TWI_Ptr++] = data[i];
+        TWI_BufferXOR ^= data[i];
+    }
+    if (TWI_Ptr > 0) {
+        TWI_masterXOR = TWI_Buffer[--TWI_Ptr];
+        BOOT_isCommandFresh = 1;
+    }
+    TWI_BufferXOR ^= TWI_masterXOR;
+
+    if (isGeneralCall && BOOT_isCommandFresh) {
+        if (TWI_Ptr > TWI_BROADCAST_HEADER && TWI_Buffer[0] == 0x00 &&
+            TWI_Buffer[1] == TWI_Ptr - TWI_BROADCAST_HEADER) {
+            TWI_Ptr -= TWI_BROADCAST_HEADER;
+            memmove(TWI_Buffer, TWI_Buffer + TWI_BROADCAST_HEADER, TWI_Ptr);
+        } else {
+            BOOT_isCommandFresh = 0;
+        }
+    }
+
+    _FLASH_runNode();
+
+}
+
+// SLA+W, data, CRC, STO, or as a broadcast
+//   0x00, 0x00, LEN, data, CRC, STO
+static void _FLASH_write(const uint8_t* data, uint8_t length) {
+
+    uint8_t frame[TWI_BROADCAST_HEADER + TWI_SLW_BUFFER_SIZE + 1];
+    uint8_t address = _isBroadcast ? 0x00 : (TWAR >> 1);
+    uint8_t crc = address;
+    uint8_t n = 0;
+    uint8_t i;
+
+    if (_isBroadcast) {
+        frame[n++] = 0x00;
+        frame[n++] = length;
+    }
+    memcpy(&frame[n], data, length);
+    n += length;
+    for (i = 0; i < n; i++) {
+        crc ^= frame[i];
+    }
+    frame[n++] = crc;
+    _lastCRC = crc;
+
+    _FLASH_busTransaction(n);
+    _FLASH_receive(_isBroadcast, frame, n);
+
+}
+
+// SLA+R, reply, STO; checks ADDR, CMD and CRC
+static const uint8_t* _FLASH_read(uint8_t command, uint8_t length) {
+
+    _FLASH_busTransaction(length);
+
+    if (_replyLength != length ||
+        _reply[0] != (TWAR >> 1) ||
+        _reply[1] != command ||
+        _reply[length - 1] != _lastCRC) {
+        fprintf(stderr, "bad reply to 0x%02x\n", command);
+        _errors++;
+    }
+    TWI_readIsBusy = 0;
+
+    _FLASH_runNode();
+
+    return _reply;
+
+}
+
+static void _FLASH_writePartA(uint8_t page) {
+
+    uint8_t command[2 + SPM_PAGESIZE/2];
+
+    command[0] = BOOT_CMD_WRITE_FLASH_A;
+    command[1] = page;
+    memcpy(&command[2], &_image[page * SPM_PAGESIZE], SPM_PAGESIZE/2);
+    _FLASH_write(command, sizeof(command));
+
+}
+
+static void _FLASH_writePartB(uint8_t page) {
+
+    uint8_t command[1 + SPM_PAGESIZE/2];
+
+    command[0] = BOOT_CMD_WRITE_FLASH_B;
+    memcpy(&command[1], &_image[page * SPM_PAGESIZE + SPM_PAGESIZE/2], SPM_PAGESIZE/2);
+    _FLASH_write(command, sizeof(command));
+
+}
+
+static void _FLASH_writePage(uint8_t page) {
+
+    uint8_t command[4 + SPM_PAGESIZE];
+    uint16_t sum = 0x0000;
+    uint8_t i;
+
+    command[0] = BOOT_CMD_WRITE_FLASH_PAGE;
+    command[1] = page;
+    memcpy(&command[2], &_image[page * SPM_PAGESIZE], SPM_PAGESIZE);
+    for (i = 0; i < SPM_PAGESIZE; i += 2) {
+        sum ^= (command[2 + i] << 8) | command[3 + i];
+    }
+    command[2 + SPM_PAGESIZE] = sum >> 8;
+    command[3 + SPM_PAGESIZE] = sum & 0xFF;
+    _FLASH_write(command, sizeof(command));
+
+}
+
+// CRC-16 CCITT, as the bootloader
+static uint16_t _FLASH_crc(const uint8_t* data, uint16_t length) {
+
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+    uint8_t bit;
+    for (i = 0; i < length; i++) {
+        crc ^= data[i] << 8;
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+
+}
+
+// application checksum, as BOOT_updateAppChecksum
+static uint16_t _FLASH_imageChecksum(const uint8_t* image, uint16_t length) {
+
+    return _FLASH_crc(&image[2], length - 2);
+
+}
+
+static void _FLASH_resetNode(uint8_t station) {
+
+    // blank application section, bootloader reset vector at 0x0000
+    memset(HAL_flash, 0xFF, sizeof(HAL_flash));
+    HAL_flash[0] = ((0xC000U - 1) + BOOTLOADER_START / 2) & 0xFF;
+    HAL_flash[1] = ((0xC000U - 1) + BOOTLOADER_START / 2) >> 8;
+    memset(HAL_eeprom, 0xFF, sizeof(HAL_eeprom));
+
+    // install the application as finalised by the bootloader
+    uint16_t jump = ((_installed[1] << 8) | _installed[0]) - (0xC000 - 1);
+    uint16_t sum = _FLASH_imageChecksum(_installed, _installedLength);
+    memcpy(&HAL_flash[2], &_installed[2], _installedLength - 2);
+    eeprom_update_word((uint16_t*)EEPROM_MAGIC_START, EEPROM_MAGIC_KEY);
+    eeprom_update_word((uint16_t*)EEPROM_APP_VER_START, FLASH_APP_VERSION - 1);
+    eeprom_update_word((uint16_t*)EEPROM_APP_LEN_START, _installedLength);
+    eeprom_update_word((uint16_t*)EEPROM_APP_JMP_ADDR, jump);
+    eeprom_update_word((uint16_t*)EEPROM_APP_CRC_START, sum);
+    eeprom_update_word((uint16_t*)EEPROM_CRC_VER_START, FLASH_APP_VERSION - 1);
+    eeprom_update_word((uint16_t*)EEPROM_CRC_LEN_START, _installedLength);
+    app_jump_addr = jump;
+    HAL_nvmTime = 0;
+
+    NODE_station = station;
+    TWAR = TWI_BASE_ADDRESS + (NODE_station << 1);
+    TWI_readIsBusy = 0;
+    BOOT_isCommandFresh = 0;
+    BOOT_waitingToFlash = 0;
+    BOOT_waitingToFinalise = 0;
+    BOOT_shouldBootApp = 0;
+
+}
+
+// all pages, then finalise
+static void _FLASH_writeImage(FlashMode mode, uint8_t pages, uint16_t sum) {
+
+    uint16_t length = pages * SPM_PAGESIZE;
+    uint8_t isStreaming = (mode != FLASH_MODE_AB && mode != FLASH_MODE_PAGE);
+    uint8_t page;
+    uint8_t i;
+    const uint8_t* reply;
+
+    _pagesWritten = (mode == FLASH_MODE_DELTA) ? 0 : pages;
+
+    _isBroadcast = (mode == FLASH_MODE_BROADCAST);
+
+    // the page hashes of the installed application
+    uint16_t hashes[FLASH_APP_PAGES];
+    if (mode == FLASH_MODE_DELTA) {
+        for (page = 0; page < pages; page += BOOT_HASH_PAGES) {
+            uint8_t count = pages - page;
+            if (count > BOOT_HASH_PAGES) count = BOOT_HASH_PAGES;
+
+            uint8_t query[3] = { BOOT_CMD_PAGE_HASH, page, count };
+            _FLASH_write(query, sizeof(query));
+            reply = _FLASH_read(BOOT_CMD_PAGE_HASH, 5 + 2 * count);
+            for (i = 0; i < count; i++) {
+                hashes[page + i] = (reply[4 + 2 * i] << 8) | reply[5 + 2 * i];
+            }
+        }
+    }
+
+    for (page = 0; page < pages; page++) {
+        if (mode == FLASH_MODE_DELTA) {
+            if (hashes[page] == _FLASH_crc(&_image[page * SPM_PAGESIZE], SPM_PAGESIZE))
+                continue;
+            _FLASH_writePage(page);
+            _pagesWritten++;
+        } else if (mode == FLASH_MODE_AB || mode == FLASH_MODE_AB_STREAM) {
+            _FLASH_writePartA(page);
+            if (!isStreaming) _FLASH_read(BOOT_CMD_WRITE_FLASH_A, 3);
+            _FLASH_writePartB(page);
+            if (!isStreaming) _FLASH_read(BOOT_CMD_WRITE_FLASH_B, 3);
+        } else {
+            _FLASH_writePage(page);
+            if (!isStreaming) {
+                reply = _FLASH_read(BOOT_CMD_WRITE_FLASH_PAGE, 6);
+                if (reply[2] != page || reply[3] == 0) {
+                    fprintf(stderr, "page %u refused, status 0x%02x\n", page, reply[4]);
+                    _errors++;
+                }
+            }
+        }
+    }
+
+    // finalise, the node programs any queued pages first
+    uint8_t finalise[7] = {
+        BOOT_CMD_FINALISE_FLASH,
+        FLASH_APP_VERSION >> 8, FLASH_APP_VERSION & 0xFF,
+        length >> 8, length & 0xFF,
+        sum >> 8, sum & 0xFF
+    };
+    _FLASH_write(finalise, sizeof(finalise));
+    if (!_isBroadcast) _FLASH_read(BOOT_CMD_FINALISE_FLASH, 3);
+
+    _isBroadcast = 0;
+
+}
+
+// flash status and application checksum of the node
+static void _FLASH_verify(uint8_t pages, uint16_t sum) {
+
+    uint16_t length = pages * SPM_PAGESIZE;
+    const uint8_t* reply;
+
+    uint8_t status = BOOT_CMD_FLASH_STATUS;
+    _FLASH_write(&status, 1);
+    reply = _FLASH_read(BOOT_CMD_FLASH_STATUS, 6);
+    if (reply[2] != 0 || reply[3] != _pagesWritten || reply[4] != 0) {
+        fprintf(stderr, "station %u flash status: pending %u written %u status 0x%02x\n",
+            NODE_station, reply[2], reply[3], reply[4]);
+        _errors++;
+    }
+
+    uint8_t crc = BOOT_CMD_APP_CRC;
+    _FLASH_write(&crc, 1);
+    reply = _FLASH_read(BOOT_CMD_APP_CRC, 5);
+    if (((reply[2] << 8) | reply[3]) != sum) {
+        fprintf(stderr, "station %u app checksum 0x%02x%02x, expected 0x%04x\n",
+            NODE_station, reply[2], reply[3], sum);
+        _errors++;
+    }
+
+    // the checksum is stored for this version and length, booting
+    //   must not compute it again
+    uint32_t nvmTime = HAL_nvmTime;
+    BOOT_checkAppChecksum();
+    if (HAL_nvmTime != nvmTime) {
+        fprintf(stderr, "station %u app checksum computed again at boot\n", NODE_station);
+        _errors++;
+    }
+
+    // the reset vector stays with the bootloader, the application's
+    //   is kept as its jump address
+    uint16_t jump = ((_image[1] << 8) | _image[0]) - (0xC000 - 1);
+    if (eeprom_read_word((uint16_t*)EEPROM_APP_JMP_ADDR) != jump) {
+        fprintf(stderr, "station %u app jump address 0x%04x, expected 0x%04x\n",
+            NODE_station, eeprom_read_word((uint16_t*)EEPROM_APP_JMP_ADDR), jump);
+        _errors++;
+    }
+    if (memcmp(&HAL_flash[2], &_image[2], length - 2) != 0) {
+        fprintf(stderr, "station %u flash does not match the image\n", NODE_station);
+        _errors++;
+    }
+
+}
+
+static void _FLASH_run(FlashMode mode, uint8_t pages, uint8_t nodes) {
+
+    uint16_t sum = _FLASH_imageChecksum(_image, pages * SPM_PAGESIZE);
+    double verified = 0;
+    uint8_t station;
+
+    _now = 0;
+    _transactions = 0;
+    _busBytes = 0;
+    _busTime = 0;
+    _errors = 0;
+
+    for (station = 0; station < nodes; station++) {
+        _FLASH_resetNode(station);
+        _nodeBusyUntil = 0;
+
+        if (mode == FLASH_MODE_BROADCAST) {
+            // every node receives the same broadcasts from the start,
+            //   the bus time of the first is the bus time of all
+            uint32_t transactions = _transactions;
+            uint32_t busBytes = _busBytes;
+            double busTime = _busTime;
+
+            _now = 0;
+            _FLASH_writeImage(mode, pages, sum);
+            if (station > 0) {
+                _transactions = transactions;
+                _busBytes = busBytes;
+                _busTime = busTime;
+            }
+
+            // then each node is verified in turn
+            if (_now < verified) {
+                _now = verified;
+            }
+        } else {
+            _FLASH_writeImage(mode, pages, sum);
+        }
+
+        _FLASH_verify(pages, sum);
+        verified = _now;
+    }
+
+    printf("%-12s %12u %10u %10.1f %10.1f %10.1f  %s\n",
+        _modeNames[mode], _transactions, _busBytes,
+        _busTime / 1000.0, HAL_nvmTime / 1000.0,
+        _now / 1000.0, _errors ? "FAIL" : "ok");
+
+}
+
+static void _FLASH_usage(void) {
+
+    fprintf(stderr, "usage: oreoled_flash [-m ab|ab-stream|page|page-stream|broadcast|delta] "
+        "[-k khz] [-l pages] [-c nodes] [-r seed] [-i image.hex] [-I installed.hex] "
+        "[-p bytes]\n");
+    exit(1);
+
+}
+
+// reads an Intel HEX application into image, returns its length in pages
+static uint8_t _FLASH_readHex(const char* path, uint8_t* image) {
+
+    FILE* file = fopen(path, "r");
+    char line[600];
+    uint32_t base = 0;
+    uint32_t end = 0;
+
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+
+    memset(image, 0xFF, BOOTLOADER_START);
+    while (fgets(line, sizeof(line), file)) {
+        uint8_t record[256 + 5];
+        uint8_t sum = 0;
+        uint16_t n = 0;
+        char* c;
+
+        if (line[0] != ':') continue;
+        for (c = line + 1; c[0] && c[1] && n < sizeof(record); c += 2) {
+            unsigned int byte;
+            if (sscanf(c, "%2x", &byte) != 1) break;
+            record[n++] = byte;
+            sum += byte;
+        }
+        if (n < 5 || n != record[0] + 5 || sum != 0) {
+            fprintf(stderr, "%s: bad record: %s", path, line);
+            exit(1);
+        }
+
+        uint32_t address = base + ((record[1] << 8) | record[2]);
+        switch (record[3]) {
+            case 0x00:
+                if (address + record[0] > BOOTLOADER_START) {
+                    fprintf(stderr, "%s: data beyond the application section\n", path);
+                    exit(1);
+                }
+                memcpy(&image[address], &record[4], record[0]);
+                if (address + record[0] > end) end = address + record[0];
+                break;
+            case 0x02: base = ((record[4] << 8) | record[5]) << 4; break;
+            case 0x04: base = ((record[4] << 8) | record[5]) << 16; break;
+        }
+    }
+    fclose(file);
+
+    if (end == 0) {
+        fprintf(stderr, "%s: no data\n", path);
+        exit(1);
+    }
+    return (end + SPM_PAGESIZE - 1) / SPM_PAGESIZE;
+
+}
+
+int main(int argc, char** argv) {
+
+    int mode = -1;
+    uint32_t khz = 100;
+    uint32_t pages = FLASH_APP_PAGES;
+    uint32_t nodes = 1;
+    uint32_t seed = 1;
+    uint32_t patch = 16;
+    const char* imagePath = NULL;
+    const char* installedPath = NULL;
+    uint32_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:k:l:c:r:i:I:p:")) != -1) {
+        switch (opt) {
+            case 'm':
+                for (mode = 0; mode < FLASH_MODE_COUNT; mode++) {
+                    if (strcmp(optarg, _modeNames[mode]) == 0) break;
+                }
+                if (mode == FLASH_MODE_COUNT) _FLASH_usage();
+                break;
+            case 'k': khz = strtoul(optarg, NULL, 0); break;
+            case 'l': pages = strtoul(optarg, NULL, 0); break;
+            case 'c': nodes = strtoul(optarg, NULL, 0); break;
+            case 'r': seed = strtoul(optarg, NULL, 0); break;
+            case 'i': imagePath = optarg; break;
+            case 'I': installedPath = optarg; break;
+            case 'p': patch = strtoul(optarg, NULL, 0); break;
+            default: _FLASH_usage();
+        }
+    }
+    if (khz == 0 || pages == 0 || pages > FLASH_APP_PAGES) _FLASH_usage();
+    if (nodes == 0 || nodes > 4) _FLASH_usage();
+
+    _bitTime = 1000.0 / khz;
+
+    // random image, starting with an RJMP to the application
+    srand(seed);
+    if (imagePath) {
+        pages = _FLASH_readHex(imagePath, _image);
+    } else {
+        for (i = 0; i < sizeof(_image); i++) {
+            _image[i] = rand();
+        }
+        _image[0] = 0x12;
+        _image[1] = 0xC0;
+    }
+
+    // the installed application, a few bytes differ from the image
+    if (installedPath) {
+        _installedLength = _FLASH_readHex(installedPath, _installed) * SPM_PAGESIZE;
+    } else {
+        memcpy(_installed, _image, sizeof(_installed));
+        for (i = 0; i < patch; i++) {
+            _installed[2 + rand() % (pages * SPM_PAGESIZE - 2)] ^= 1 + rand() % 0xFF;
+        }
+        _installedLength = pages * SPM_PAGESIZE;
+    }
+
+    uint8_t changed = 0;
+    for (i = 0; i < pages; i++) {
+        if (i * SPM_PAGESIZE >= _installedLength ||
+            memcmp(&_image[i * SPM_PAGESIZE], &_installed[i * SPM_PAGESIZE], SPM_PAGESIZE) != 0) {
+            changed++;
+        }
+    }
+
+    printf("%u pages (%u changed) at %u kHz to %u node%s, nvm ms per node\n",
+        pages, changed, khz, nodes, nodes > 1 ? "s" : "");
+    printf("%-12s %12s %10s %10s %10s %10s  %s\n",
+        "mode", "transactions", "bus bytes", "bus ms", "nvm ms", "total ms", "result");
+
+    uint8_t failed = 0;
+    for (i = 0; i < FLASH_MODE_COUNT; i++) {
+        if (mode >= 0 && (int)i != mode) continue;
+        _FLASH_run(i, pages, nodes);
+        failed |= _errors;
+    }
+
+    return failed ? 1 : 0;
+
+}
@@ -0,0 +1,308 @@
+/**********************************************************************
+
+  oreoled_host.c - host native driver for the application modules.
+    Links the firmware sources built against the host HAL and runs the
+    same sequence as the target mainloop, one Timer1 overflow (clock
+    tick) at a time, so the pattern pipeline can be profiled, fuzzed
+    and compared against golden output without hardware.
+
+    Commands are delivered through TWI_vect exactly as the TWI hardware
+    would present them, and general call sync pulses are sent at a
+    configurable interval. Broadcasts are sent as general call data.
+
+    Usage:
+      oreoled_host [-t ticks] [-o every] [-n station] [-s sync_ticks]
+                   [-c tick:hexbytes]... [-g tick:hexbytes]...
+                   [-f frames] [-r seed] [-b]
+
+      -t  number of clock ticks to run (default one 4s period)
+      -o  print a CSV output line every N ticks (0 disables)
+      -n  node station id (0 ~ 3)
+      -s  general call sync interval in ticks (0 disables)
+      -c  send a command (pattern + params, without the XOR byte) at tick
+      -g  send a broadcast (station records, without the XOR byte) at tick
+      -f  fuzz with this many random frames spread over the run
+      -r  random seed for fuzzing
+      -b  benchmark: no output, report ticks per second, the
+          number of skipped pattern evaluations and of TWI frames
+          dropped by the receive queue
+
+
+  Authors: 
+    Nate Fisher
+
+  Created: 
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "hal.h"
+#include "pattern_generator.h"
+#include "light_pattern_protocol.h"
+#include "synchro_clock.h"
+#include "twi_manager.h"
+#include "waveform_generator.h"
+#include "scheduler.h"
+#include "node_manager.h"
+
+// Timer0 (ch3 PWM) runs 8x slower than Timer1 (clock tick)
+#define HOST_TIMER0_DIVIDER     8
+
+#define HOST_MAX_COMMANDS       64
+
+void TWI_vect(void);
+void TIMER1_OVF_vect(void);
+void TIMER0_OVF_vect(void);
+void TIMER0_COMPB_vect(void);
+
+extern uint8_t NODE_station;
+
+typedef struct _Host_Command {
+    uint32_t tick;
+    uint8_t length;
+    uint8_t isBroadcast;
+    uint8_t data[TWI_MAX_BUFFER_SIZE];
+} HostCommand;
+
+static HostCommand _commands[HOST_MAX_COMMANDS];
+static int _commandCount;
+
+static void _HOST_twiEvent(uint8_t status, uint8_t data) {
+
+    TWSR = status;
+    TWDR = data;
+    TWI_vect();
+
+}
+
+// addressed write: SLA+W, data..., XOR, STOP
+static void _HOST_sendCommand(const uint8_t* data, uint8_t length) {
+
+    uint8_t xor = TWAR >> 1;
+    uint8_t i;
+
+    _HOST_twiEvent(TWI_SRX_ADR_ACK, 0);
+    for (i = 0; i < length; i++) {
+        _HOST_twiEvent(TWI_SRX_ADR_DATA_ACK, data[i]);
+        xor ^= data[i];
+    }
+    _HOST_twiEvent(TWI_SRX_ADR_DATA_ACK, xor);
+    _HOST_twiEvent(TWI_SRX_STOP_RESTART, 0);
+
+}
+
+// general call write: data..., XOR, STOP
+static void _HOST_sendBroadcast(const uint8_t* data, uint8_t length) {
+
+    uint8_t xor = 0;
+    uint8_t i;
+
+    _HOST_twiEvent(TWI_SRX_GEN_ACK, 0);
+    for (i = 0; i < length; i++) {
+        _HOST_twiEvent(TWI_SRX_GEN_DATA_ACK, data[i]);
+        xor ^= data[i];
+    }
+    _HOST_twiEvent(TWI_SRX_GEN_DATA_ACK, xor);
+    _HOST_twiEvent(TWI_SRX_STOP_RESTART, 0);
+
+}
+
+static void _HOST_sendSync(void) {
+
+    _HOST_twiEvent(TWI_SRX_GEN_ACK, 0);
+    _HOST_twiEvent(TWI_SRX_STOP_RESTART, 0);
+
+}
+
+// same sequence as main() in src/main.c
+static void _HOST_init(uint8_t station) {
+
+    SCHED_init();
+    SYNCLK_init();
+
+    PIND = station << 6;
+    NODE_init();
+
+    TWI_init(NODE_station);
+
+    PG_init(&pgRed);
+    PG_init(&pgGreen);
+    PG_init(&pgBlue);
+
+	LPP_pattern_protocol.redPattern = &pgRed;
+	LPP_pattern_protocol.greenPattern = &pgGreen;
+	LPP_pattern_protocol.bluePattern = &pgBlue;
+
+    uint8_t* wavegen_inputs[3] = {&(pgRed.value), &(pgGreen.value), &(pgBlue.value)};
+    WG_init(wavegen_inputs, 3);
+    WG_onOverflow(SYNCLK_updateClock);
+
+    sei();
+
+}
+
+// one pass of the application mainloop, handling the events 
+//   posted during this tick (the host does not sleep)
+static void _HOST_mainloop(void) {
+
+    uint8_t events = SCHED_take();
+
+    if (events & SCHED_EVENT_STARTUP_FAIL) {
+        LPP_discardStaged();
+        LPP_setParamMacro(PARAM_MACRO_RESET);
+        LPP_setParamMacro(PARAM_MACRO_AUTOMOBILE_COLORS);
+    }
+
+    if (events & SCHED_EVENT_COMMAND)
+        LPP_processBuffer();
+
+    if (events & SCHED_EVENT_SYNC)
+        LPP_onSync();
+
+    if (events & SCHED_EVENT_CLOCK_TICK) {
+        uint16_t clockPosition = SYNCLK_getClockPosition();
+        PatternGenerator* patterns[3] = {&pgRed, &pgGreen, &pgBlue};
+        PG_calcGroup(patterns, 3, clockPosition);
+
+        WG_updatePWM();
+
+        SYNCLK_calcPhaseCorrection();
+    }
+
+}
+
+static int _HOST_parseCommand(const char* arg, uint8_t isBroadcast) {
+
+    if (_commandCount == HOST_MAX_COMMANDS) return -1;
+
+    HostCommand* command = &_commands[_commandCount];
+    char* end;
+    command->tick = strtoul(arg, &end, 0);
+    if (*end != ':') return -1;
+    end++;
+
+    command->length = 0;
+    command->isBroadcast = isBroadcast;
+    while (end[0] && end[1]) {
+        unsigned byte;
+        if (sscanf(end, "%2x", &byte) != 1) return -1;
+        if (command->length == TWI_MAX_BUFFER_SIZE - 1) return -1;
+        command->data[command->length++] = byte;
+        end += 2;
+    }
+
+    _commandCount++;
+    return 0;
+
+}
+
+static void _HOST_usage(void) {
+
+    fprintf(stderr, "usage: oreoled_host [-t ticks] [-o every] [-n station] [-s sync_ticks] "
+        "[-c tick:hexbytes]... [-g tick:hexbytes]... [-f frames] [-r seed] [-b]\n");
+    exit(2);
+
+}
+
+int main(int argc, char* argv[]) {
+
+    uint32_t ticks = 15625;
+    uint32_t outputEvery = 1;
+    uint32_t syncTicks = 15625;
+    uint32_t fuzzFrames = 0;
+    uint8_t station = 0;
+    uint8_t isBenchmark = 0;
+    unsigned seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:o:n:s:c:g:f:r:b")) != -1) {
+        switch (opt) {
+            case 't': ticks = strtoul(optarg, NULL, 0); break;
+            case 'o': outputEvery = strtoul(optarg, NULL, 0); break;
+            case 'n': station = strtoul(optarg, NULL, 0) & 0x03; break;
+            case 's': syncTicks = strtoul(optarg, NULL, 0); break;
+            case 'c': if (_HOST_parseCommand(optarg, 0)) _HOST_usage(); break;
+            case 'g': if (_HOST_parseCommand(optarg, 1)) _HOST_usage(); break;
+            case 'f': fuzzFrames = strtoul(optarg, NULL, 0); break;
+            case 'r': seed = strtoul(optarg, NULL, 0); break;
+            case 'b': isBenchmark = 1; break;
+            default: _HOST_usage();
+        }
+    }
+
+    if (isBenchmark) outputEvery = 0;
+    srand(seed);
+
+    // a watchdog reset re-runs the firmware initialisation
+    jmp_buf resetTarget;
+    HAL_resetTarget = &resetTarget;
+    if (setjmp(resetTarget)) {
+        if (outputEvery) printf("# reset\n");
+    }
+    _HOST_init(station);
+
+    if (outputEvery)
+        printf("tick,clock,red,green,blue,ocr1b,ocr1a,ocr0b,ddrb\n");
+
+    clock_t start = clock();
+
+    static uint32_t tick;
+    for (; tick < ticks; tick++) {
+
+        // interrupts for this tick
+        TIMER1_OVF_vect();
+        if (tick % HOST_TIMER0_DIVIDER == 0) {
+            if (TIMSK0 & TIMSK0_TOIE0) TIMER0_OVF_vect();
+            if (TIMSK0 & TIMSK0_OCIE0B) TIMER0_COMPB_vect();
+        }
+
+        if (syncTicks && tick % syncTicks == 0)
+            _HOST_sendSync();
+
+        int i;
+        for (i = 0; i < _commandCount; i++) {
+            if (_commands[i].tick != tick) continue;
+            if (_commands[i].isBroadcast)
+                _HOST_sendBroadcast(_commands[i].data, _commands[i].length);
+            else
+                _HOST_sendCommand(_commands[i].data, _commands[i].length);
+        }
+
+        if (fuzzFrames && (uint32_t)rand() % ticks < fuzzFrames) {
+            uint8_t frame[TWI_MAX_BUFFER_SIZE];
+            uint8_t length = rand() % 16;
+            uint8_t j;
+            for (j = 0; j < length; j++) {
+                frame[j] = rand();
+                // avoid the reset nonce most of the time
+                if (frame[j] == PARAM_RESET && rand() % 16) frame[j] = PARAM_REPEAT;
+            }
+            _HOST_sendCommand(frame, length);
+        }
+
+        _HOST_mainloop();
+
+        if (outputEvery && tick % outputEvery == 0) {
+            printf("%u,%u,%u,%u,%u,%u,%u,%u,%u\n", tick, SYNCLK_getClockPosition(),
+                pgRed.value, pgGreen.value, pgBlue.value,
+                OCR1BL, OCR1AL, OCR0B, DDRB & 0x07);
+        }
+
+    }
+
+    if (isBenchmark) {
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("%u ticks in %.3f s, %.0f ticks/s\n", ticks, seconds,
+            seconds > 0 ? ticks / seconds : 0.0);
+        printf("%u pattern evaluations skipped\n", PG_getSkipCount());
+        printf("%u TWI frames dropped\n", TWI_getDropCount());
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,359 @@
+/**********************************************************************
+
+  pg_compare.c - compares the fixed-point pattern generator against
+    the double precision PG_calc it replaced (reference below, taken
+    from the baseline with the zero crossing fix applied, so fades
+    and repeats progress in both engines).
+
+    Every pattern is run for one full period (15625 clock ticks)
+    through both engines from the same clock positions, over a set
+    of bias, amplitude, speed and phase combinations. A sample fails
+    when the two values differ by more than PG_COMPARE_BOUND, unless
+    the reference output steps by more than that on an adjacent tick
+    and the fixed-point value matches it there (an edge one tick
+    early or late). Siren samples close to tan(theta) == inf, where
+    one binary angle step of theta moves the reference output by more
+    than the bound, are not compared.
+
+    Usage:
+      pg_compare [-v]
+
+      -v  print every failing sample
+
+    Exits non-zero if any case fails.
+
+
+  Authors:
+    Nate Fisher
+
+  Created:
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "pattern_generator.h"
+#include "utilities.h"
+
+// ticks per 4s period, see _SYNCLK_TICKS_PER_PERIOD
+#define PG_COMPARE_TICKS        15625UL
+
+// largest allowed difference of the two outputs, in output counts
+#define PG_COMPARE_BOUND        1
+
+
+#define _TWO_PI                 6.283185307179586
+
+////////////////////////////////////////////////////////////////
+// reference engine, the baseline PG_calc
+////////////////////////////////////////////////////////////////
+
+typedef struct _Reference_Generator {
+    int8_t cyclesRemaining;
+    PatternEnum pattern;
+    double theta;
+    uint8_t speed;
+    double phase;
+    double amplitude;
+    uint8_t bias;
+    uint8_t value;
+    uint8_t isNewCycle;
+} ReferenceGenerator;
+
+// the baseline assigned the double straight to the 8-bit value, which
+//   is undefined outside 0 ~ 255 (negative siren and fwupdate lobes).
+//   truncate and clamp it as the fixed-point engine does
+static uint8_t _REF_toValue(double value) {
+
+    if (value < 0) return 0;
+    return (value > 255) ? 255 : (uint8_t)value;
+
+}
+
+static void _REF_calc(ReferenceGenerator* self, double clock_position) {
+
+    // update pattern instance theta
+    {
+        // calculate theta, in radians, from the current timer
+        double theta_at_speed = clock_position * self->speed;
+
+        // calculate the speed and phase adjusted theta
+        double new_theta = fmod(theta_at_speed + self->phase, _TWO_PI);
+
+        // set zero crossing flag (the baseline set it after theta
+        //   was overwritten, so cycles were never counted)
+        self->isNewCycle = (self->theta > new_theta) ? 1 : 0;
+
+        // set pattern theta
+        self->theta = new_theta;
+    }
+
+    // decrement the cycles remaining until
+    // equals CYCLES_STOP
+    if (self->isNewCycle && self->cyclesRemaining >= 0)
+        self->cyclesRemaining--;
+
+    // update pattern value
+    switch(self->pattern) {
+
+        case PATTERN_FWUPDATE:
+            if (self->cyclesRemaining != CYCLES_STOP) {
+                double carrier = sin(self->theta);
+                self->value = _REF_toValue(self->bias + self->amplitude * carrier);
+            }
+            break;
+
+        case PATTERN_BREATHE:
+            if (self->cyclesRemaining != CYCLES_STOP) {
+                double carrier = fabs(cos(self->theta));
+                self->value = _REF_toValue(self->bias * (self->amplitude * carrier));
+            }
+            break;
+
+        case PATTERN_STROBE:
+            if (self->cyclesRemaining != CYCLES_STOP) {
+                float carrier = (sin(self->theta) > 0) ? 1 : 0;
+                self->value = _REF_toValue(self->bias * carrier);
+            }
+            break;
+
+        case PATTERN_AVIATION_STROBE:
+            if (self->cyclesRemaining != CYCLES_STOP) {
+                float carrier = (sin(self->theta) > 0.6 && sin(self->theta) < 0.8) ? 1 : 0;
+                self->value = _REF_toValue(self->bias * carrier);
+            }
+            break;
+
+        case PATTERN_SIREN:
+            if (self->cyclesRemaining != CYCLES_STOP) {
+                float carrier = sin(tan(self->theta)*.5);
+                self->value = _REF_toValue(self->bias * (self->amplitude * carrier));
+            }
+            break;
+
+        case PATTERN_SOLID:
+            self->value = self->bias;
+            break;
+
+        case PATTERN_FADEOUT:
+            if (self->cyclesRemaining > 0) return;
+            if (self->cyclesRemaining == 0) {
+                double carrier = cos(self->theta/4);
+                self->value = _REF_toValue(self->amplitude * carrier);
+            } else {
+                self->value = 0;
+            }
+            break;
+
+        case PATTERN_FADEIN:
+            if (self->cyclesRemaining > 0) return;
+            if (self->cyclesRemaining == 0) {
+                double carrier = sin(self->theta/4);
+                self->value = _REF_toValue(self->bias * carrier);
+            } else {
+                self->value = self->bias;
+            }
+            break;
+
+        case PATTERN_PING:
+            break;
+
+        case PATTERN_OFF:
+        default:
+            self->value = 0;
+
+    }
+
+}
+
+// change of the reference siren output for one binary angle step of
+//   theta. close to tan(theta) == inf this exceeds the bound, and 
+//   the output is not defined to within a count by any fixed angle
+static double _REF_sirenStep(ReferenceGenerator* self) {
+
+    double cosine = cos(self->theta);
+    double slope = self->bias * self->amplitude *
+        cos(tan(self->theta) * .5) * .5 / (cosine * cosine);
+
+    return fabs(slope) * _TWO_PI / 0x10000;
+
+}
+
+////////////////////////////////////////////////////////////////
+// cases
+////////////////////////////////////////////////////////////////
+
+typedef struct _Compare_Case {
+    PatternEnum pattern;
+    uint8_t bias;
+    uint8_t amplitude;
+    uint8_t speed;
+    uint16_t phaseDegrees;
+    int8_t cycles;
+} CompareCase;
+
+static const CompareCase _cases[] = {
+    {PATTERN_OFF,             200,   1, 1,   0, -2},
+    {PATTERN_SOLID,           200,   1, 1,   0, -2},
+    {PATTERN_SOLID,             7,   1, 3,  90, -2},
+    {PATTERN_BREATHE,         200,   1, 1,   0, -2},
+    {PATTERN_BREATHE,         255,   1, 2, 180, -2},
+    {PATTERN_BREATHE,         100,   2, 1,  45, -2},
+    {PATTERN_BREATHE,          17,  15, 4, 270, -2},
+    {PATTERN_SIREN,           200,   1, 1,   0, -2},
+    {PATTERN_SIREN,            60,   4, 2,  30, -2},
+    {PATTERN_STROBE,          200,   1, 1,   0, -2},
+    {PATTERN_STROBE,          255,   1, 5, 120, -2},
+    {PATTERN_AVIATION_STROBE, 200,   1, 1,   0, -2},
+    {PATTERN_AVIATION_STROBE, 255,   1, 5,  60, -2},
+    {PATTERN_FWUPDATE,        120, 120, 1, 270, -2},
+    {PATTERN_FWUPDATE,         50,  50, 1,  90, -2},
+    {PATTERN_FWUPDATE,         70,  70, 2, 180, -2},
+    {PATTERN_FADEIN,          200,   1, 1,   0,  0},
+    {PATTERN_FADEIN,          255,   1, 1,  10,  1},
+    {PATTERN_FADEOUT,         200, 200, 1,   0,  0},
+    {PATTERN_FADEOUT,           0, 255, 1,  10,  1},
+};
+
+#define PG_COMPARE_CASES    (sizeof(_cases) / sizeof(_cases[0]))
+
+static uint8_t _isVerbose;
+
+// clock position of a tick, as a binary angle
+static uint16_t _position(uint32_t tick) {
+
+    return (uint16_t)((tick % PG_COMPARE_TICKS) * 0x10000UL / PG_COMPARE_TICKS);
+
+}
+
+// run one case through both engines, returns the number of failures
+//   and counts the samples which were not compared
+static uint32_t _runCase(const CompareCase* test, uint32_t* maxError, uint32_t* skipped) {
+
+    static uint8_t expected[PG_COMPARE_TICKS];
+    static uint8_t actual[PG_COMPARE_TICKS];
+    static uint8_t isSkipped[PG_COMPARE_TICKS];
+
+    PatternGenerator pg;
+    PG_init(&pg);
+    pg.pattern = test->pattern;
+    pg.bias = test->bias;
+    pg.amplitude = test->amplitude;
+    pg.speed = test->speed;
+    pg.phase = UTIL_degToAngle(test->phaseDegrees);
+    pg.cyclesRemaining = test->cycles;
+
+    ReferenceGenerator ref = {0};
+    ref.pattern = test->pattern;
+    ref.bias = test->bias;
+    ref.amplitude = test->amplitude;
+    ref.speed = test->speed;
+    ref.phase = test->phaseDegrees * _TWO_PI / 360.0;
+    ref.cyclesRemaining = test->cycles;
+
+    // both engines start at the first tick's theta, so the first
+    //   evaluation is not taken as a zero crossing
+    ref.theta = fmod(ref.phase, _TWO_PI);
+    pg.theta = pg.phase;
+
+    // the cycle being counted must run a whole period
+    uint32_t ticks = PG_COMPARE_TICKS * (test->cycles > 0 ? test->cycles + 1 : 1);
+    uint32_t first = ticks - PG_COMPARE_TICKS;
+
+    uint32_t tick;
+    for (tick = 0; tick < ticks; tick++) {
+        uint16_t position = _position(tick);
+
+        _REF_calc(&ref, position * _TWO_PI / 0x10000);
+        PG_calc(&pg, position);
+
+        if (tick < first) continue;
+        expected[tick - first] = ref.value;
+        actual[tick - first] = pg.value;
+        isSkipped[tick - first] = test->pattern == PATTERN_SIREN &&
+            _REF_sirenStep(&ref) > PG_COMPARE_BOUND;
+    }
+
+    uint32_t failures = 0;
+    uint32_t i;
+    for (i = 0; i < PG_COMPARE_TICKS; i++) {
+        if (isSkipped[i]) {
+            (*skipped)++;
+            continue;
+        }
+
+        uint32_t error = abs((int)expected[i] - (int)actual[i]);
+        if (error <= PG_COMPARE_BOUND) continue;
+
+        // the reference one tick early or late, where it steps or
+        //   moves by more than the bound from tick to tick
+        uint8_t low = expected[i], high = expected[i];
+        if (i > 0) {
+            if (expected[i - 1] < low) low = expected[i - 1];
+            if (expected[i - 1] > high) high = expected[i - 1];
+        }
+        if (i + 1 < PG_COMPARE_TICKS) {
+            if (expected[i + 1] < low) low = expected[i + 1];
+            if (expected[i + 1] > high) high = expected[i + 1];
+        }
+        if (actual[i] + PG_COMPARE_BOUND >= low &&
+            actual[i] <= high + PG_COMPARE_BOUND) continue;
+
+        if (error > *maxError) *maxError = error;
+        failures++;
+        if (_isVerbose)
+            printf("  tick %u: reference %u, fixed point %u\n",
+                (unsigned)(first + i), expected[i], actual[i]);
+    }
+
+    return failures;
+
+}
+
+int main(int argc, char* argv[]) {
+
+    int opt;
+    while ((opt = getopt(argc, argv, "v")) != -1) {
+        switch (opt) {
+            case 'v': _isVerbose = 1; break;
+            default:
+                fprintf(stderr, "usage: pg_compare [-v]\n");
+                return 2;
+        }
+    }
+
+    uint32_t failedCases = 0;
+    uint32_t i;
+    for (i = 0; i < PG_COMPARE_CASES; i++) {
+        const CompareCase* test = &_cases[i];
+        uint32_t maxError = 0;
+        uint32_t skipped = 0;
+        uint32_t failures = _runCase(test, &maxError, &skipped);
+
+        printf("pattern %u bias %u amplitude %u speed %u phase %u cycles %d: ",
+            test->pattern, test->bias, test->amplitude, test->speed,
+            test->phaseDegrees, test->cycles);
+        if (failures) {
+            printf("%u samples off by up to %u\n", (unsigned)failures, (unsigned)maxError);
+            failedCases++;
+        } else if (skipped) {
+            printf("ok, %u samples not compared\n", (unsigned)skipped);
+        } else {
+            printf("ok\n");
+        }
+    }
+
+    if (failedCases) {
+        printf("%u of %u cases differ by more than %u\n",
+            (unsigned)failedCases, (unsigned)PG_COMPARE_CASES, PG_COMPARE_BOUND);
+        return 1;
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,232 @@
+/**********************************************************************
+
+  synclk_sim.c - host simulation of several nodes phase locking their
+    synchro clocks to the general call sync pulse. Each node runs the
+    firmware synchro clock (src/synchro_clock.c) from its own RC
+    oscillator, with a random frequency error and a random power up
+    time, and the mainloop phase correction after every clock tick.
+    The master sends a sync pulse at the start of every 4s period.
+
+    The phase error of each node against the master is sampled after
+    every tick, and the tool reports per node:
+
+      - lock time, from power up until the error last exceeded the
+        lock threshold
+      - steady state RMS and maximum error over the final quarter
+        of the run
+      - the statistics kept by the node itself over the final 
+        quarter (see SYNCLK_getSyncStats, reset at the first sync 
+        pulse of the quarter as a PARAM_SYNC_STATS read would): phase
+        error range, interval range and frequency trim
+
+    Usage:
+      synclk_sim [-n nodes] [-t seconds] [-d drift_ppm] [-j jitter_us]
+                 [-l lock_us] [-p kp] [-i ki] [-r seed] [-v]
+
+      -n  number of nodes (default 4)
+      -t  simulated time in seconds (default 120)
+      -d  maximum oscillator frequency error in ppm (default 10000)
+      -j  maximum sync pulse latency in us (default 0)
+      -l  lock threshold in us (default 1000)
+      -p  proportional gain, Q8 (default SYNCLK_KP_DEFAULT)
+      -i  integral gain, Q8 (default SYNCLK_KI_DEFAULT)
+      -r  random seed
+      -v  print the phase error of every node at each sync pulse
+
+
+  Authors:
+    Nate Fisher
+
+  Created:
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "hal.h"
+#include "synchro_clock.h"
+#include "scheduler.h"
+
+#define SIM_MAX_NODES           64
+#define SIM_SYNC_PERIOD         4.0
+#define SIM_TICK_PERIOD         (SIM_SYNC_PERIOD / _SYNCLK_TICKS_PER_PERIOD)
+
+typedef struct _Sim_Node {
+    SyncroClock clock;
+    double drift;           // relative oscillator frequency error
+    double startTime;       // power up time, s
+    double nextTick;        // time of the next timer1 overflow, s
+    double lockTime;        // last time the error exceeded the threshold, s
+    double errorSquares;    // steady state error statistics, s
+    double errorMax;
+    uint32_t errorSamples;
+} SimNode;
+
+static SimNode _nodes[SIM_MAX_NODES];
+
+static double _SIM_random(void) {
+
+    return (double)rand() / RAND_MAX;
+
+}
+
+// phase error of the node clock against the master, in s,
+//  positive if the node is ahead
+static double _SIM_phaseError(double time) {
+
+    double node = SYNCLK_getClockPosition() / 65536.0;
+    double master = fmod(time, SIM_SYNC_PERIOD) / SIM_SYNC_PERIOD;
+    double error = node - master;
+
+    if (error >= 0.5) error -= 1.0;
+    if (error < -0.5) error += 1.0;
+
+    return error * SIM_SYNC_PERIOD;
+
+}
+
+static void _SIM_usage(void) {
+
+    fprintf(stderr, "usage: synclk_sim [-n nodes] [-t seconds] [-d drift_ppm] [-j jitter_us] "
+        "[-l lock_us] [-p kp] [-i ki] [-r seed] [-v]\n");
+    exit(2);
+
+}
+
+int main(int argc, char* argv[]) {
+
+    int nodeCount = 4;
+    double duration = 120;
+    double driftMax = 10000e-6;
+    double jitterMax = 0;
+    double lockThreshold = 1000e-6;
+    uint16_t kp = SYNCLK_KP_DEFAULT;
+    uint16_t ki = SYNCLK_KI_DEFAULT;
+    uint8_t isVerbose = 0;
+    unsigned seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:d:j:l:p:i:r:v")) != -1) {
+        switch (opt) {
+            case 'n': nodeCount = atoi(optarg); break;
+            case 't': duration = atof(optarg); break;
+            case 'd': driftMax = atof(optarg) * 1e-6; break;
+            case 'j': jitterMax = atof(optarg) * 1e-6; break;
+            case 'l': lockThreshold = atof(optarg) * 1e-6; break;
+            case 'p': kp = strtoul(optarg, NULL, 0); break;
+            case 'i': ki = strtoul(optarg, NULL, 0); break;
+            case 'r': seed = strtoul(optarg, NULL, 0); break;
+            case 'v': isVerbose = 1; break;
+            default: _SIM_usage();
+        }
+    }
+    if (nodeCount < 1 || nodeCount > SIM_MAX_NODES) _SIM_usage();
+
+    srand(seed);
+    SCHED_init();
+    sei();
+
+    // power up every node at a random point in the first period
+    int i;
+    for (i = 0; i < nodeCount; i++) {
+        SimNode* node = &_nodes[i];
+        node->drift = (2 * _SIM_random() - 1) * driftMax;
+        node->startTime = _SIM_random() * SIM_SYNC_PERIOD;
+        node->nextTick = node->startTime;
+        node->lockTime = node->startTime;
+
+        SYNCLK_init();
+        SYNCLK_setGains(kp, ki);
+        SYNCLK_swapState(&node->clock);
+    }
+
+    double steadyStart = duration * 0.75;
+    double nextSync = SIM_SYNC_PERIOD;
+
+    while (1) {
+
+        // find the next event, a node tick or the sync pulse
+        SimNode* next = NULL;
+        for (i = 0; i < nodeCount; i++) {
+            if (!next || _nodes[i].nextTick < next->nextTick) next = &_nodes[i];
+        }
+        double time = (next->nextTick < nextSync) ? next->nextTick : nextSync;
+        if (time >= duration) break;
+
+        if (time == nextSync) {
+            // sync pulse, every node records its phase error when
+            //   the general call completes
+            for (i = 0; i < nodeCount; i++) {
+                SimNode* node = &_nodes[i];
+                if (node->startTime > time) continue;
+
+                SYNCLK_swapState(&node->clock);
+                if (jitterMax > 0) {
+                    // the pulse is late by up to the jitter, catch up
+                    //   with the ticks which fall within the latency
+                    double latency = _SIM_random() * jitterMax;
+                    while (node->nextTick < time + latency) {
+                        SYNCLK_updateClock();
+                        SYNCLK_calcPhaseCorrection();
+                        node->nextTick += SIM_TICK_PERIOD / (1 + node->drift);
+                    }
+                }
+                if (time >= steadyStart && time < steadyStart + SIM_SYNC_PERIOD)
+                    SYNCLK_resetSyncStats();
+                SYNCLK_recordPhaseError();
+                if (isVerbose) printf("%.0f,%d,%.1f\n", time, i, _SIM_phaseError(time) * 1e6);
+                SYNCLK_swapState(&node->clock);
+            }
+            nextSync += SIM_SYNC_PERIOD;
+            continue;
+        }
+
+        // timer1 overflow followed by one mainloop pass
+        SYNCLK_swapState(&next->clock);
+        SYNCLK_updateClock();
+        SYNCLK_calcPhaseCorrection();
+
+        double error = fabs(_SIM_phaseError(time));
+        if (error > lockThreshold) next->lockTime = time;
+        if (time >= steadyStart) {
+            next->errorSquares += error * error;
+            if (error > next->errorMax) next->errorMax = error;
+            next->errorSamples++;
+        }
+        SYNCLK_swapState(&next->clock);
+
+        next->nextTick += SIM_TICK_PERIOD / (1 + next->drift);
+
+    }
+
+    printf("node,drift_ppm,lock_s,rms_us,max_us,"
+        "stats_error_min_us,stats_error_max_us,stats_interval_min,stats_interval_max,stats_trim_ppm\n");
+    double lockWorst = 0, rmsWorst = 0, maxWorst = 0;
+    for (i = 0; i < nodeCount; i++) {
+        SimNode* node = &_nodes[i];
+        double lock = node->lockTime - node->startTime;
+        double rms = node->errorSamples ? sqrt(node->errorSquares / node->errorSamples) : 0;
+
+        SyncStats stats;
+        SYNCLK_swapState(&node->clock);
+        SYNCLK_getSyncStats(&stats);
+        SYNCLK_swapState(&node->clock);
+
+        printf("%d,%.0f,%.3f,%.1f,%.1f,%d,%d,%u,%u,%d\n", i, node->drift * 1e6, lock,
+            rms * 1e6, node->errorMax * 1e6, stats.phaseErrorMin, stats.phaseErrorMax,
+            stats.intervalMin, stats.intervalMax, stats.frequencyTrim);
+
+        if (lock > lockWorst) lockWorst = lock;
+        if (rms > rmsWorst) rmsWorst = rms;
+        if (node->errorMax > maxWorst) maxWorst = node->errorMax;
+    }
+    printf("# worst: lock %.3f s, rms %.1f us, max %.1f us%s\n", lockWorst, rmsWorst * 1e6,
+        maxWorst * 1e6, (lockWorst > steadyStart) ? " (not locked)" : "");
+
+    return 0;
+
+}
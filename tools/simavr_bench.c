@@ -0,0 +1,330 @@
+/**********************************************************************
+
+  simavr_bench.c - cycle counting benchmark for the firmware hot paths.
+    Runs the firmware ELF under simavr one instruction at a time and
+    attributes cycles to the functions and interrupt vectors named on
+    the command line. A function is entered when the program counter
+    reaches its symbol address, and left when the stack pointer rises
+    above the value it had on entry (ret/reti popped the return address).
+    Cycles are inclusive, so an ISR that fires inside a function is
+    counted against both.
+
+    One main loop iteration is counted per call of the iteration marker
+    function (WG_updatePWM by default, called once per loop).
+
+    The longest stretch with global interrupts disabled (an ISR body, 
+    or a cli section) is reported as the worst case interrupt latency, 
+    along with the tracked function it was spent in.
+
+    Usage:
+      simavr_bench [-m mcu] [-f hz] [-s seconds] [-i marker]
+                   firmware.elf firmware.sym func [func...]
+
+    The .sym file is the output of avr-nm for the same ELF. The report
+    is written to stdout as JSON.
+
+
+  Authors:
+    Nate Fisher
+
+  Created:
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+
+#define BENCH_MAX_FUNCTIONS     16
+#define BENCH_MAX_DEPTH         32
+
+// interrupt vector numbers of the ATtiny88, used to give
+//   the __vector_N symbols readable names in the report
+static const char* _BENCH_vectorNames[] = {
+    [7]  = "WDT_vect",
+    [11] = "TIMER1_OVF_vect",
+    [12] = "TIMER0_COMPA_vect",
+    [13] = "TIMER0_COMPB_vect",
+    [14] = "TIMER0_OVF_vect",
+    [19] = "TWI_vect",
+};
+
+typedef struct _Bench_Function {
+    const char* name;
+    const char* symbol;
+    uint32_t address;
+    uint32_t calls;
+    uint64_t cyclesTotal;
+    uint64_t cyclesMin;
+    uint64_t cyclesMax;
+} BenchFunction;
+
+typedef struct _Bench_Frame {
+    BenchFunction* function;
+    uint16_t stackPointer;
+    avr_cycle_count_t entryCycle;
+} BenchFrame;
+
+static BenchFunction _functions[BENCH_MAX_FUNCTIONS];
+static int _functionCount;
+static BenchFrame _frames[BENCH_MAX_DEPTH];
+static int _frameDepth;
+
+// interrupts disabled tracking
+static int _interruptsSeen;
+static int _blockedDepth;
+static avr_cycle_count_t _blockedStart;
+static const char* _blockedIn;
+static uint64_t _blockedMaxCycles;
+static const char* _blockedMaxIn;
+
+// translate __vector_N into the avr-libc vector name
+static const char* _BENCH_displayName(const char* symbol) {
+
+    int vector;
+    if (sscanf(symbol, "__vector_%d", &vector) == 1 &&
+        vector >= 0 &&
+        vector < (int)(sizeof(_BENCH_vectorNames) / sizeof(*_BENCH_vectorNames)) &&
+        _BENCH_vectorNames[vector])
+        return _BENCH_vectorNames[vector];
+
+    return symbol;
+
+}
+
+// look up symbol addresses in avr-nm output ("0000012a T PG_calc")
+static int _BENCH_loadSymbols(const char* path) {
+
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long address;
+        char type;
+        char name[200];
+        if (sscanf(line, "%lx %c %199s", &address, &type, name) != 3) continue;
+        if (type != 'T' && type != 't') continue;
+
+        int i;
+        for (i = 0; i < _functionCount; i++) {
+            if (strcmp(_functions[i].symbol, name) == 0)
+                _functions[i].address = address;
+        }
+    }
+
+    fclose(f);
+
+    int i;
+    for (i = 0; i < _functionCount; i++) {
+        if (_functions[i].address == UINT32_MAX) {
+            fprintf(stderr, "symbol not found: %s\n", _functions[i].symbol);
+            return -1;
+        }
+    }
+
+    return 0;
+
+}
+
+static uint16_t _BENCH_stackPointer(avr_t* avr) {
+
+    return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+
+}
+
+// close any frames whose return address has been popped
+static void _BENCH_checkReturns(avr_t* avr) {
+
+    uint16_t sp = _BENCH_stackPointer(avr);
+
+    while (_frameDepth > 0 && sp > _frames[_frameDepth - 1].stackPointer) {
+        BenchFrame* frame = &_frames[--_frameDepth];
+        uint64_t cycles = avr->cycle - frame->entryCycle;
+
+        frame->function->calls++;
+        frame->function->cyclesTotal += cycles;
+        if (cycles < frame->function->cyclesMin) frame->function->cyclesMin = cycles;
+        if (cycles > frame->function->cyclesMax) frame->function->cyclesMax = cycles;
+    }
+
+}
+
+// open a frame if the program counter sits on a tracked entry point
+static void _BENCH_checkEntry(avr_t* avr) {
+
+    int i;
+    for (i = 0; i < _functionCount; i++) {
+        if (avr->pc != _functions[i].address) continue;
+
+        if (_frameDepth == BENCH_MAX_DEPTH) {
+            fprintf(stderr, "call depth exceeded at %s\n", _functions[i].name);
+            exit(1);
+        }
+
+        _frames[_frameDepth].function = &_functions[i];
+        _frames[_frameDepth].stackPointer = _BENCH_stackPointer(avr);
+        _frames[_frameDepth].entryCycle = avr->cycle;
+        _frameDepth++;
+        return;
+    }
+
+}
+
+// time the stretches with the global interrupt flag clear, starting
+//   after the firmware first enables interrupts
+static void _BENCH_checkInterruptsBlocked(avr_t* avr) {
+
+    if (avr->sreg[S_I]) {
+        if (_blockedStart) {
+            // otherwise the function that disabled interrupts
+            if (!_blockedIn && _frameDepth > 0)
+                _blockedIn = _frames[_frameDepth - 1].function->name;
+
+            uint64_t cycles = avr->cycle - _blockedStart;
+            if (cycles > _blockedMaxCycles) {
+                _blockedMaxCycles = cycles;
+                _blockedMaxIn = _blockedIn ? _blockedIn : "(untracked)";
+            }
+            _blockedStart = 0;
+        }
+        _interruptsSeen = 1;
+        return;
+    }
+
+    if (!_interruptsSeen) return;
+
+    if (!_blockedStart) {
+        _blockedStart = avr->cycle;
+        _blockedDepth = _frameDepth;
+        _blockedIn = NULL;
+    }
+
+    // the first tracked function entered while blocked, the ISR itself
+    if (!_blockedIn && _frameDepth > _blockedDepth)
+        _blockedIn = _frames[_frameDepth - 1].function->name;
+
+}
+
+static void _BENCH_usage(void) {
+
+    fprintf(stderr, "usage: simavr_bench [-m mcu] [-f hz] [-s seconds] [-i marker] "
+        "firmware.elf firmware.sym func [func...]\n");
+    exit(2);
+
+}
+
+int main(int argc, char* argv[]) {
+
+    const char* mcu = "attiny88";
+    const char* marker = "WG_updatePWM";
+    uint32_t frequency = 8000000;
+    double seconds = 2.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:f:s:i:")) != -1) {
+        switch (opt) {
+            case 'm': mcu = optarg; break;
+            case 'f': frequency = strtoul(optarg, NULL, 0); break;
+            case 's': seconds = atof(optarg); break;
+            case 'i': marker = optarg; break;
+            default: _BENCH_usage();
+        }
+    }
+
+    if (argc - optind < 3) _BENCH_usage();
+    if (argc - optind - 2 > BENCH_MAX_FUNCTIONS) {
+        fprintf(stderr, "at most %d functions can be tracked\n", BENCH_MAX_FUNCTIONS);
+        return 2;
+    }
+
+    const char* elfPath = argv[optind];
+    const char* symPath = argv[optind + 1];
+
+    int i;
+    for (i = optind + 2; i < argc; i++) {
+        BenchFunction* fn = &_functions[_functionCount++];
+        fn->symbol = argv[i];
+        fn->name = _BENCH_displayName(argv[i]);
+        fn->address = UINT32_MAX;
+        fn->cyclesMin = UINT64_MAX;
+    }
+
+    if (_BENCH_loadSymbols(symPath)) return 1;
+
+    BenchFunction* iterationMarker = NULL;
+    for (i = 0; i < _functionCount; i++) {
+        if (strcmp(_functions[i].symbol, marker) == 0)
+            iterationMarker = &_functions[i];
+    }
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(elfPath, &firmware)) {
+        fprintf(stderr, "unable to load %s\n", elfPath);
+        return 1;
+    }
+
+    avr_t* avr = avr_make_mcu_by_name(mcu);
+    if (!avr) {
+        fprintf(stderr, "simavr has no core for %s\n", mcu);
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    avr->frequency = frequency;
+
+    // step one instruction at a time, checking returns first so
+    //   that a tail call into a tracked function is seen as a new frame
+    avr_cycle_count_t endCycle = (avr_cycle_count_t)(seconds * frequency);
+    int state = cpu_Running;
+    while (avr->cycle < endCycle &&
+           state != cpu_Done && state != cpu_Crashed) {
+        state = avr_run(avr);
+        _BENCH_checkReturns(avr);
+        _BENCH_checkEntry(avr);
+        _BENCH_checkInterruptsBlocked(avr);
+    }
+
+    uint32_t iterations = iterationMarker ? iterationMarker->calls : 0;
+
+    // report
+    printf("{\n");
+    printf("  \"mcu\": \"%s\",\n", mcu);
+    printf("  \"f_cpu\": %u,\n", frequency);
+    printf("  \"cycles\": %llu,\n", (unsigned long long)avr->cycle);
+    printf("  \"iteration_marker\": \"%s\",\n", marker);
+    printf("  \"iterations\": %u,\n", iterations);
+    printf("  \"cycles_per_iteration\": %.1f,\n",
+        iterations ? (double)avr->cycle / iterations : 0.0);
+    printf("  \"irq_blocked_max_cycles\": %llu,\n", (unsigned long long)_blockedMaxCycles);
+    printf("  \"irq_blocked_max_in\": \"%s\",\n", _blockedMaxIn ? _blockedMaxIn : "");
+    printf("  \"functions\": [\n");
+    for (i = 0; i < _functionCount; i++) {
+        BenchFunction* fn = &_functions[i];
+        printf("    {\"name\": \"%s\", \"symbol\": \"%s\", \"calls\": %u, "
+            "\"cycles_total\": %llu, \"cycles_min\": %llu, \"cycles_max\": %llu, "
+            "\"cycles_per_call\": %.1f, \"cycles_per_iteration\": %.1f}%s\n",
+            fn->name, fn->symbol, fn->calls,
+            (unsigned long long)fn->cyclesTotal,
+            (unsigned long long)(fn->calls ? fn->cyclesMin : 0),
+            (unsigned long long)fn->cyclesMax,
+            fn->calls ? (double)fn->cyclesTotal / fn->calls : 0.0,
+            iterations ? (double)fn->cyclesTotal / iterations : 0.0,
+            (i + 1 < _functionCount) ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    return (state == cpu_Crashed) ? 1 : 0;
+
+}
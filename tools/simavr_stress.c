@@ -0,0 +1,178 @@
+/**********************************************************************
+
+  simavr_stress.c - clock snapshot stress test. Runs a firmware ELF
+    built with SYNCLK_STRESS_TEST under simavr, where the mainloop
+    reads the synchro clock position continuously while the timer1
+    ISR advances it (see SYNCLK_stressTest in src/synchro_clock.c).
+    The firmware counts the reads, the reads the ISR fired during,
+    and the torn reads; this tool reports those counters.
+
+    Exits non-zero if any read was torn, or if the ISR never fired
+    during a read, in which case the test proved nothing.
+
+    Usage:
+      simavr_stress [-m mcu] [-f hz] [-s seconds] firmware.elf firmware.sym
+
+    The .sym file is the output of avr-nm for the same ELF. The report
+    is written to stdout as JSON.
+
+
+  Authors:
+    Nate Fisher
+
+  Created:
+    Wed Oct 1, 2014
+
+**********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+
+// avr-nm lists data addresses in the 0x800000 data space
+#define STRESS_DATA_OFFSET      0x800000
+
+typedef struct _Stress_Counter {
+    const char* symbol;
+    uint32_t address;
+} StressCounter;
+
+static StressCounter _counters[] = {
+    {"SYNCLK_stressReads", UINT32_MAX},
+    {"SYNCLK_stressInterrupted", UINT32_MAX},
+    {"SYNCLK_stressTorn", UINT32_MAX},
+};
+#define STRESS_COUNTER_COUNT    (sizeof(_counters) / sizeof(*_counters))
+
+// look up counter addresses in avr-nm output ("00800140 B SYNCLK_stressTorn")
+static int _STRESS_loadSymbols(const char* path) {
+
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long address;
+        char type;
+        char name[200];
+        if (sscanf(line, "%lx %c %199s", &address, &type, name) != 3) continue;
+        if (type != 'B' && type != 'D' && type != 'C') continue;
+
+        unsigned i;
+        for (i = 0; i < STRESS_COUNTER_COUNT; i++) {
+            if (strcmp(_counters[i].symbol, name) == 0)
+                _counters[i].address = address - STRESS_DATA_OFFSET;
+        }
+    }
+
+    fclose(f);
+
+    unsigned i;
+    for (i = 0; i < STRESS_COUNTER_COUNT; i++) {
+        if (_counters[i].address == UINT32_MAX) {
+            fprintf(stderr, "symbol not found: %s (built without SYNCLK_STRESS_TEST?)\n",
+                _counters[i].symbol);
+            return -1;
+        }
+    }
+
+    return 0;
+
+}
+
+static uint32_t _STRESS_readCounter(avr_t* avr, const StressCounter* counter) {
+
+    const uint8_t* data = &avr->data[counter->address];
+    return data[0] | (data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+
+}
+
+static void _STRESS_usage(void) {
+
+    fprintf(stderr, "usage: simavr_stress [-m mcu] [-f hz] [-s seconds] "
+        "firmware.elf firmware.sym\n");
+    exit(2);
+
+}
+
+int main(int argc, char* argv[]) {
+
+    const char* mcu = "attiny88";
+    uint32_t frequency = 8000000;
+    double seconds = 10.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:f:s:")) != -1) {
+        switch (opt) {
+            case 'm': mcu = optarg; break;
+            case 'f': frequency = strtoul(optarg, NULL, 0); break;
+            case 's': seconds = atof(optarg); break;
+            default: _STRESS_usage();
+        }
+    }
+
+    if (argc - optind != 2) _STRESS_usage();
+
+    const char* elfPath = argv[optind];
+    const char* symPath = argv[optind + 1];
+
+    if (_STRESS_loadSymbols(symPath)) return 1;
+
+    elf_firmware_t firmware;
+    memset(&firmware, 0, sizeof(firmware));
+    if (elf_read_firmware(elfPath, &firmware)) {
+        fprintf(stderr, "unable to load %s\n", elfPath);
+        return 1;
+    }
+
+    avr_t* avr = avr_make_mcu_by_name(mcu);
+    if (!avr) {
+        fprintf(stderr, "simavr has no core for %s\n", mcu);
+        return 1;
+    }
+    avr_init(avr);
+    avr_load_firmware(avr, &firmware);
+    avr->frequency = frequency;
+
+    avr_cycle_count_t endCycle = (avr_cycle_count_t)(seconds * frequency);
+    int state = cpu_Running;
+    while (avr->cycle < endCycle &&
+           state != cpu_Done && state != cpu_Crashed) {
+        state = avr_run(avr);
+    }
+
+    uint32_t reads = _STRESS_readCounter(avr, &_counters[0]);
+    uint32_t interrupted = _STRESS_readCounter(avr, &_counters[1]);
+    uint32_t torn = _STRESS_readCounter(avr, &_counters[2]);
+
+    // report
+    printf("{\n");
+    printf("  \"mcu\": \"%s\",\n", mcu);
+    printf("  \"f_cpu\": %u,\n", frequency);
+    printf("  \"cycles\": %llu,\n", (unsigned long long)avr->cycle);
+    printf("  \"reads\": %u,\n", reads);
+    printf("  \"reads_interrupted\": %u,\n", interrupted);
+    printf("  \"reads_torn\": %u\n", torn);
+    printf("}\n");
+
+    if (state == cpu_Crashed) return 1;
+    if (interrupted == 0) {
+        fprintf(stderr, "the timer1 ISR never fired during a read\n");
+        return 1;
+    }
+    if (torn != 0) {
+        fprintf(stderr, "%u of %u clock reads were torn\n", torn, reads);
+        return 1;
+    }
+
+    return 0;
+
+}